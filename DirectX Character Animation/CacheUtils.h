@@ -0,0 +1,538 @@
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "MeshUtils.h"
+#include "dev5_anim.h"
+
+using namespace std;
+
+// Read only memory mapping of a whole file, unmapped when closed or destroyed
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& rhs) noexcept { *this = std::move(rhs); }
+	MappedFile& operator=(MappedFile&& rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			Close();
+			std::swap(file, rhs.file);
+			std::swap(mapping, rhs.mapping);
+			std::swap(data, rhs.data);
+			std::swap(size, rhs.size);
+		}
+		return *this;
+	}
+
+	bool Open(const std::string& path)
+	{
+		Close();
+
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize = {};
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+		{
+			Close();
+			return false;
+		}
+
+		data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data)
+		{
+			Close();
+			return false;
+		}
+
+		size = (size_t)fileSize.QuadPart;
+		return true;
+	}
+
+	void Close()
+	{
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+		data = nullptr;
+		size = 0;
+	}
+
+	bool IsOpen() const { return data != nullptr; }
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+namespace CacheUtils
+{
+	// 64 bit FNV-1a
+	inline uint64_t HashBytes(const void* bytes, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+	{
+		const uint8_t* p = (const uint8_t*)bytes;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= p[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	// Content hash of a source asset, 0 when it can not be read
+	inline uint64_t HashFile(const std::string& path)
+	{
+		MappedFile source;
+		if (!source.Open(path))
+			return 0;
+		return HashBytes(source.Data(), source.Size());
+	}
+
+	const size_t CACHE_BLOB_ALIGNMENT = 16;
+
+	inline uint64_t AlignOffset(uint64_t offset)
+	{
+		return (offset + CACHE_BLOB_ALIGNMENT - 1) & ~(uint64_t)(CACHE_BLOB_ALIGNMENT - 1);
+	}
+
+	// Writes a blob at the next aligned offset and returns that offset
+	inline uint64_t WriteBlob(std::ofstream& out, const void* data, size_t size)
+	{
+		uint64_t offset = AlignOffset((uint64_t)out.tellp());
+		static const char zeros[CACHE_BLOB_ALIGNMENT] = {};
+		out.write(zeros, (std::streamsize)(offset - (uint64_t)out.tellp()));
+		if (size)
+			out.write((const char*)data, size);
+		return offset;
+	}
+
+	inline bool BlobInFile(uint64_t offset, uint64_t size, size_t fileSize)
+	{
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+
+	// Caches are baked into <path>.tmp and renamed over the cache once
+	// complete, so an interrupted bake never leaves a file that opens
+	inline std::string TempCachePath(const std::string& path)
+	{
+		return path + ".tmp";
+	}
+
+	// Closes a cache written to TempCachePath(path) and moves it over path,
+	// the temporary file is deleted when any write failed
+	inline bool CommitCacheFile(std::ofstream& out, const std::string& path)
+	{
+		const std::string tempPath = TempCachePath(path);
+		out.close();
+		if (!out || !MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			DeleteFileA(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Baked mesh cache
+//
+// A header followed by the vertex, index, cluster, LOD, decode constant and
+// texture name blobs, each 16 byte aligned. The blobs are laid out exactly
+// as they are uploaded so a mapped file goes straight to CreateBuffer.
+//--------------------------------------------------------------------------------------
+const uint32_t MESH_CACHE_MAGIC = 0x4853454d;	// "MESH"
+// bump when the file layout changes
+const uint32_t MESH_CACHE_VERSION = 1;
+
+// bits of MeshCacheHeader::flags, import settings that change the baked data
+const uint32_t MESH_CACHE_OVERDRAW_OPTIMIZED = 1u << 0;
+
+struct MeshCacheHeader
+{
+	uint32_t magic = MESH_CACHE_MAGIC;
+	uint32_t version = MESH_CACHE_VERSION;
+	uint32_t importerVersion = 0;
+	uint32_t flags = 0;
+	uint64_t sourceHash = 0;
+	float importScale = 1.0f;
+	uint32_t vertexStride = 0;
+
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+	uint32_t indexSize = 0;
+	uint32_t clusterCount = 0;
+	uint32_t lodCount = 0;
+	uint32_t decodeSize = 0;
+	uint32_t textureLength = 0;
+	uint32_t pad = 0;
+
+	// blob offsets from the start of the file
+	uint64_t vertexOffset = 0;
+	uint64_t indexOffset = 0;
+	uint64_t clusterOffset = 0;
+	uint64_t lodOffset = 0;
+	uint64_t decodeOffset = 0;
+	uint64_t textureOffset = 0;
+};
+
+// What the cache has to match to be used
+struct MeshCacheKey
+{
+	uint64_t sourceHash = 0;
+	uint32_t importerVersion = 0;
+	uint32_t flags = 0;
+	float importScale = 1.0f;
+	uint32_t vertexStride = 0;
+};
+
+// Pointers into a mapped mesh cache, valid while the view is alive
+struct MeshCacheView
+{
+	MappedFile file;
+	const MeshCacheHeader* header = nullptr;
+	const void* vertices = nullptr;
+	const void* indices = nullptr;
+	const MeshCluster* clusters = nullptr;
+	const MeshLod* lods = nullptr;
+	const void* decodeData = nullptr;
+	std::string textureFilename;
+};
+
+namespace CacheUtils
+{
+	template <typename T>
+	bool WriteMeshCache(const std::string& path, const MeshCacheKey& key, const SimpleMesh<T>& simpleMesh,
+		const std::string& textureFilename, const vector<MeshCluster>& clusters, const vector<MeshLod>& lods,
+		const void* decodeData = nullptr, uint32_t decodeSize = 0)
+	{
+		std::ofstream out(TempCachePath(path), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!out.is_open())
+			return false;
+
+		const bool indices16 = !simpleMesh.indicesList16.empty();
+
+		MeshCacheHeader header;
+		header.importerVersion = key.importerVersion;
+		header.flags = key.flags;
+		header.sourceHash = key.sourceHash;
+		header.importScale = key.importScale;
+		header.vertexStride = sizeof(T);
+		header.vertexCount = (uint32_t)simpleMesh.vertexList.size();
+		header.indexCount = (uint32_t)(indices16 ? simpleMesh.indicesList16.size() : simpleMesh.indicesList.size());
+		header.indexSize = indices16 ? sizeof(uint16_t) : sizeof(int);
+		header.clusterCount = (uint32_t)clusters.size();
+		header.lodCount = (uint32_t)lods.size();
+		header.decodeSize = decodeData ? decodeSize : 0;
+		header.textureLength = (uint32_t)textureFilename.size();
+
+		// the header is rewritten once the offsets are known
+		out.write((const char*)&header, sizeof(header));
+		header.vertexOffset = WriteBlob(out, simpleMesh.vertexList.data(), simpleMesh.vertexList.size() * sizeof(T));
+		if (indices16)
+			header.indexOffset = WriteBlob(out, simpleMesh.indicesList16.data(), simpleMesh.indicesList16.size() * sizeof(uint16_t));
+		else
+			header.indexOffset = WriteBlob(out, simpleMesh.indicesList.data(), simpleMesh.indicesList.size() * sizeof(int));
+		header.clusterOffset = WriteBlob(out, clusters.data(), clusters.size() * sizeof(MeshCluster));
+		header.lodOffset = WriteBlob(out, lods.data(), lods.size() * sizeof(MeshLod));
+		header.decodeOffset = WriteBlob(out, decodeData, header.decodeSize);
+		header.textureOffset = WriteBlob(out, textureFilename.data(), textureFilename.size());
+
+		out.seekp(0);
+		out.write((const char*)&header, sizeof(header));
+		return CommitCacheFile(out, path);
+	}
+
+	// Maps the cache and checks it against the key, false when the file is
+	// missing, truncated or stale (different source, importer or settings)
+	inline bool OpenMeshCache(const std::string& path, const MeshCacheKey& key, MeshCacheView& view)
+	{
+		view = MeshCacheView();
+		if (!view.file.Open(path))
+			return false;
+
+		if (view.file.Size() < sizeof(MeshCacheHeader))
+		{
+			view.file.Close();
+			return false;
+		}
+
+		const uint8_t* base = view.file.Data();
+		const size_t size = view.file.Size();
+		const MeshCacheHeader* header = (const MeshCacheHeader*)base;
+
+		if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+			header->importerVersion != key.importerVersion || header->sourceHash != key.sourceHash ||
+			header->flags != key.flags || header->importScale != key.importScale ||
+			header->vertexStride != key.vertexStride)
+		{
+			view.file.Close();
+			return false;
+		}
+
+		if (!BlobInFile(header->vertexOffset, (uint64_t)header->vertexCount * header->vertexStride, size) ||
+			!BlobInFile(header->indexOffset, (uint64_t)header->indexCount * header->indexSize, size) ||
+			!BlobInFile(header->clusterOffset, (uint64_t)header->clusterCount * sizeof(MeshCluster), size) ||
+			!BlobInFile(header->lodOffset, (uint64_t)header->lodCount * sizeof(MeshLod), size) ||
+			!BlobInFile(header->decodeOffset, header->decodeSize, size) ||
+			!BlobInFile(header->textureOffset, header->textureLength, size))
+		{
+			view.file.Close();
+			return false;
+		}
+
+		view.header = header;
+		view.vertices = base + header->vertexOffset;
+		view.indices = base + header->indexOffset;
+		view.clusters = (const MeshCluster*)(base + header->clusterOffset);
+		view.lods = (const MeshLod*)(base + header->lodOffset);
+		view.decodeData = header->decodeSize ? base + header->decodeOffset : nullptr;
+		view.textureFilename.assign((const char*)base + header->textureOffset, header->textureLength);
+		return true;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Baked animation clip
+//
+// A header followed by the frame times and the frame x joint transform
+// array, each 16 byte aligned, which is the layout of dev5::anim_clip_t
+// so a mapped clip is used in place. The skeleton is not part of the
+// file, the loader attaches it after mapping.
+//--------------------------------------------------------------------------------------
+const uint32_t ANIM_CLIP_CACHE_MAGIC = 0x50494c43;	// "CLIP"
+// bump when the file layout changes
+const uint32_t ANIM_CLIP_CACHE_VERSION = 2;
+
+struct AnimClipCacheHeader
+{
+	uint32_t magic = ANIM_CLIP_CACHE_MAGIC;
+	uint32_t version = ANIM_CLIP_CACHE_VERSION;
+	uint32_t importerVersion = 0;
+	uint32_t frameCount = 0;
+	uint64_t sourceHash = 0;
+	float duration = 0.0f;
+	uint32_t jointCount = 0;
+
+	// blob offsets from the start of the file
+	uint64_t timeOffset = 0;
+	uint64_t transformOffset = 0;
+};
+
+namespace CacheUtils
+{
+	inline bool WriteAnimClipCache(const std::string& path, uint64_t sourceHash, uint32_t importerVersion, const dev5::anim_clip_t& clip)
+	{
+		std::ofstream out(TempCachePath(path), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!out.is_open())
+			return false;
+
+		AnimClipCacheHeader header;
+		header.importerVersion = importerVersion;
+		header.sourceHash = sourceHash;
+		header.duration = clip.duration;
+		header.frameCount = (uint32_t)clip.frame_count;
+		header.jointCount = (uint32_t)clip.joint_count;
+
+		// the header is rewritten once the offsets are known
+		out.write((const char*)&header, sizeof(header));
+		header.timeOffset = WriteBlob(out, clip.times(), clip.frame_count * sizeof(float));
+		header.transformOffset = WriteBlob(out, clip.transforms(), (size_t)clip.frame_count * clip.joint_count * sizeof(end::float4x4));
+
+		out.seekp(0);
+		out.write((const char*)&header, sizeof(header));
+		return CommitCacheFile(out, path);
+	}
+
+	// Maps a baked clip and points the clip at it without copying, false
+	// when the file is missing, truncated or stale
+	inline bool OpenAnimClipCache(const std::string& path, uint64_t sourceHash, uint32_t importerVersion, dev5::anim_clip_t& clip)
+	{
+		auto file = std::make_shared<MappedFile>();
+		if (!file->Open(path) || file->Size() < sizeof(AnimClipCacheHeader))
+			return false;
+
+		const uint8_t* base = file->Data();
+		const size_t size = file->Size();
+		const AnimClipCacheHeader* header = (const AnimClipCacheHeader*)base;
+
+		if (header->magic != ANIM_CLIP_CACHE_MAGIC || header->version != ANIM_CLIP_CACHE_VERSION ||
+			header->importerVersion != importerVersion || header->sourceHash != sourceHash)
+			return false;
+
+		if (!BlobInFile(header->timeOffset, (uint64_t)header->frameCount * sizeof(float), size) ||
+			!BlobInFile(header->transformOffset, (uint64_t)header->frameCount * header->jointCount * sizeof(end::float4x4), size))
+			return false;
+
+		clip = dev5::anim_clip_t();
+		clip.duration = header->duration;
+		clip.frame_count = (int)header->frameCount;
+		clip.joint_count = (int)header->jointCount;
+		clip.mapped_times = (const float*)(base + header->timeOffset);
+		clip.mapped_transforms = (const end::float4x4*)(base + header->transformOffset);
+		clip.mapping = file;
+		return true;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Baked clip library
+//
+// Every clip of one FBX in a single file: a header, then per clip the frame
+// times and the frame x joint transform array laid out as in the .clip
+// file, then the clip names and a table with one entry per clip. All clips
+// share the skeleton, which the loader attaches after mapping.
+//--------------------------------------------------------------------------------------
+const uint32_t CLIP_LIBRARY_CACHE_MAGIC = 0x42494c43;	// "CLIB"
+// bump when the file layout changes
+const uint32_t CLIP_LIBRARY_CACHE_VERSION = 1;
+
+struct ClipLibraryCacheHeader
+{
+	uint32_t magic = CLIP_LIBRARY_CACHE_MAGIC;
+	uint32_t version = CLIP_LIBRARY_CACHE_VERSION;
+	uint32_t importerVersion = 0;
+	uint32_t clipCount = 0;
+	uint64_t sourceHash = 0;
+	uint32_t jointCount = 0;
+	uint32_t nameSize = 0;
+
+	// blob offsets from the start of the file
+	uint64_t nameOffset = 0;
+	uint64_t tableOffset = 0;
+};
+
+struct ClipLibraryCacheEntry
+{
+	float duration = 0.0f;
+	uint32_t frameCount = 0;
+	// range of the name blob
+	uint32_t nameStart = 0;
+	uint32_t nameLength = 0;
+	uint64_t timeOffset = 0;
+	uint64_t transformOffset = 0;
+};
+
+namespace CacheUtils
+{
+	inline bool WriteClipLibraryCache(const std::string& path, uint64_t sourceHash, uint32_t importerVersion, const dev5::clip_library_t& library)
+	{
+		std::ofstream out(TempCachePath(path), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!out.is_open())
+			return false;
+
+		ClipLibraryCacheHeader header;
+		header.importerVersion = importerVersion;
+		header.sourceHash = sourceHash;
+		header.clipCount = (uint32_t)library.clips.size();
+		header.jointCount = library.clips.empty() ? 0 : (uint32_t)library.clips.front().joint_count;
+
+		// the header is rewritten once the offsets are known
+		out.write((const char*)&header, sizeof(header));
+
+		std::vector<ClipLibraryCacheEntry> table(library.clips.size());
+		std::string names;
+		for (size_t i = 0; i < library.clips.size(); i++)
+		{
+			const dev5::anim_clip_t& clip = library.clips[i];
+			assert((uint32_t)clip.joint_count == header.jointCount);
+
+			ClipLibraryCacheEntry& entry = table[i];
+			entry.duration = clip.duration;
+			entry.frameCount = (uint32_t)clip.frame_count;
+			entry.nameStart = (uint32_t)names.size();
+			entry.nameLength = (uint32_t)library.names[i].size();
+			names += library.names[i];
+
+			entry.timeOffset = WriteBlob(out, clip.times(), clip.frame_count * sizeof(float));
+			entry.transformOffset = WriteBlob(out, clip.transforms(), (size_t)clip.frame_count * clip.joint_count * sizeof(end::float4x4));
+		}
+
+		header.nameSize = (uint32_t)names.size();
+		header.nameOffset = WriteBlob(out, names.data(), names.size());
+		header.tableOffset = WriteBlob(out, table.data(), table.size() * sizeof(ClipLibraryCacheEntry));
+
+		out.seekp(0);
+		out.write((const char*)&header, sizeof(header));
+		return CommitCacheFile(out, path);
+	}
+
+	// Maps a baked clip library, every clip points into the one mapping.
+	// False when the file is missing, truncated or stale.
+	inline bool OpenClipLibraryCache(const std::string& path, uint64_t sourceHash, uint32_t importerVersion, dev5::clip_library_t& library)
+	{
+		library = dev5::clip_library_t();
+		auto file = std::make_shared<MappedFile>();
+		if (!file->Open(path) || file->Size() < sizeof(ClipLibraryCacheHeader))
+			return false;
+
+		const uint8_t* base = file->Data();
+		const size_t size = file->Size();
+		const ClipLibraryCacheHeader* header = (const ClipLibraryCacheHeader*)base;
+
+		if (header->magic != CLIP_LIBRARY_CACHE_MAGIC || header->version != CLIP_LIBRARY_CACHE_VERSION ||
+			header->importerVersion != importerVersion || header->sourceHash != sourceHash)
+			return false;
+
+		if (!BlobInFile(header->nameOffset, header->nameSize, size) ||
+			!BlobInFile(header->tableOffset, (uint64_t)header->clipCount * sizeof(ClipLibraryCacheEntry), size))
+			return false;
+
+		const char* names = (const char*)(base + header->nameOffset);
+		const ClipLibraryCacheEntry* table = (const ClipLibraryCacheEntry*)(base + header->tableOffset);
+
+		for (uint32_t i = 0; i < header->clipCount; i++)
+		{
+			const ClipLibraryCacheEntry& entry = table[i];
+			if (!BlobInFile(entry.nameStart, entry.nameLength, header->nameSize) ||
+				!BlobInFile(entry.timeOffset, (uint64_t)entry.frameCount * sizeof(float), size) ||
+				!BlobInFile(entry.transformOffset, (uint64_t)entry.frameCount * header->jointCount * sizeof(end::float4x4), size))
+			{
+				// the clips already added hold the mapping
+				library = dev5::clip_library_t();
+				return false;
+			}
+
+			dev5::anim_clip_t clip;
+			clip.duration = entry.duration;
+			clip.frame_count = (int)entry.frameCount;
+			clip.joint_count = (int)header->jointCount;
+			clip.mapped_times = (const float*)(base + entry.timeOffset);
+			clip.mapped_transforms = (const end::float4x4*)(base + entry.transformOffset);
+			clip.mapping = file;
+
+			library.names.emplace_back(names + entry.nameStart, entry.nameLength);
+			library.clips.push_back(std::move(clip));
+		}
+		return true;
+	}
+}
@@ -7,12 +7,22 @@
 // FBX includes
 #include <fbxsdk.h>
 #include "MeshUtils.h"
+#include "CacheUtils.h"
 #include <string>
+#include <array>
+#include <cstring>
+#include <unordered_map>
 
 #include "dev5_anim.h"
 
 FbxManager* gSdkManager;
 float scale = 0.75f;
+// run the overdraw triangle sort on static meshes loaded with LoadFBX
+bool optimizeOverdraw = false;
+// bump when LoadFBX or the passes baked into the mesh cache change their output
+const uint32_t MESH_IMPORTER_VERSION = 1;
+// bump when LoadAnimationClip changes its output
+const uint32_t ANIM_IMPORTER_VERSION = 3;
 
 using namespace dev5;
 
@@ -74,85 +84,68 @@ fbx_joint_set get_bindpose(FbxMesh& mesh)
 
 }
 
-dev5::anim_clip_t LoadAnimationClip(FbxScene* lScene, FbxMesh* mesh)
+// Converts an FBX matrix to left-hand coordinates. This mirrors x on both
+// sides of the matrix, so it commutes with the parent multiply and applies
+// to local and global transforms alike.
+float4x4 to_lh_float4x4(const FbxAMatrix& mat)
 {
-	dev5::anim_clip_t anim_clip;
-	//Load animation data
-	fbx_joint_set bind_pose = get_bindpose(*mesh);
-
-	int joint_count = (int)bind_pose.size();
-
-	auto anim_stack = lScene->GetCurrentAnimationStack();
-	FbxTimeSpan local_time_span = anim_stack->GetLocalTimeSpan();
-	FbxTime timer = local_time_span.GetDuration();
-	float duration = (float)timer.GetSecondDouble();
-	int frame_count = (int)timer.GetFrameCount(FbxTime::eFrames24);
-	anim_clip.duration = duration;
-
-	for (int frame = 0; frame < frame_count; ++frame)
+	float4x4 transform;
+	for (int r = 0; r < 4; ++r)
 	{
-		dev5::keyframe_t key_frame;
-
-		key_frame.joints.resize(bind_pose.size());
-
-		timer.SetFrame(frame, FbxTime::eFrames24);
-		key_frame.time = (float)timer.GetSecondDouble();
-
-		for (int j = 0; j < bind_pose.size(); ++j)
+		for (int c = 0; c < 4; ++c)
 		{
-			dev5::joint_t& joint = key_frame.joints[j];
-			joint.parent = bind_pose[j].parent;
-			FbxAMatrix mat = bind_pose[j].node->EvaluateGlobalTransform(timer);
-
-			for (int r = 0; r < 4; ++r)
-			{
-				for (int c = 0; c < 4; ++c)
-				{
-					joint.transform[r][c] = (float)mat[r][c];
-				}
-			}
-			{
-				joint.transform[0].y = -joint.transform[0].y;
-				joint.transform[0].z = -joint.transform[0].z;
-
-				joint.transform[1].x = -joint.transform[1].x;
-				joint.transform[2].x = -joint.transform[2].x;
-				joint.transform[3].x = -joint.transform[3].x;
-			}
-
+			transform[r][c] = (float)mat[r][c];
 		}
-		anim_clip.keyframes.push_back(std::move(key_frame));
 	}
-	return move(anim_clip);
-}
+	{
+		transform[0].y = -transform[0].y;
+		transform[0].z = -transform[0].z;
 
-// Add FBX mesh process function declaration here
-FbxMesh* ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, std::string& textureFilename);
+		transform[1].x = -transform[1].x;
+		transform[2].x = -transform[2].x;
+		transform[3].x = -transform[3].x;
+	}
+	return transform;
+}
 
-void InitFBX()
+// Each thread importing FBX files needs its own manager
+FbxManager* CreateFBXManager()
 {
-	gSdkManager = FbxManager::Create();
+	FbxManager* manager = FbxManager::Create();
 
 	// create an IOSettings object
-	FbxIOSettings* ios = FbxIOSettings::Create(gSdkManager, IOSROOT);
-	gSdkManager->SetIOSettings(ios);
+	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+	manager->SetIOSettings(ios);
+	return manager;
 }
 
-FbxScene* LoadFBXScene(const char* ImportFileName)
+void InitFBX()
 {
-	FbxScene* lScene = FbxScene::Create(gSdkManager, "");
+	gSdkManager = CreateFBXManager();
+}
 
-	FbxImporter* lImporter = FbxImporter::Create(gSdkManager, "");
+// Imports a file into a new scene of manager, nullptr when the file can
+// not be opened or imported
+FbxScene* LoadFBXScene(FbxManager* manager, const char* ImportFileName)
+{
+	FbxImporter* lImporter = FbxImporter::Create(manager, "");
 
 	// Initialize the importer by providing a filename.
-	if (!lImporter->Initialize(ImportFileName, -1, gSdkManager->GetIOSettings())) {
+	if (!lImporter->Initialize(ImportFileName, -1, manager->GetIOSettings())) {
 		printf("Call to FbxImporter::Initialize() failed.\n");
 		printf("Error returned: %s\n\n", lImporter->GetStatus().GetErrorString());
-		//exit(-1);
+		lImporter->Destroy();
+		return nullptr;
 	}
 
+	// Create a scene
+	FbxScene* lScene = FbxScene::Create(manager, "");
+
 	// Import the scene.
-	bool lStatus = lImporter->Import(lScene);
+	if (!lImporter->Import(lScene)) {
+		lScene->Destroy();
+		lScene = nullptr;
+	}
 
 	// Destroy the importer
 	lImporter->Destroy();
@@ -160,6 +153,200 @@ FbxScene* LoadFBXScene(const char* ImportFileName)
 	return lScene;
 }
 
+// Imports a file with the global manager, the scene is empty when the
+// import fails
+FbxScene* LoadFBXScene(const char* ImportFileName)
+{
+	FbxScene* lScene = LoadFBXScene(gSdkManager, ImportFileName);
+	return lScene ? lScene : FbxScene::Create(gSdkManager, "");
+}
+
+// Below this many joint samples (frames x joints) clips are baked on the
+// loading thread. Every further worker imports the file again, which only
+// pays off for long clips or large skeletons.
+const size_t PARALLEL_BAKE_MIN_SAMPLES = 1 << 16;
+
+// Frames [begin, end) of one of the clips being baked
+struct bake_range_t
+{
+	int clip;
+	int begin;
+	int end;
+};
+
+// Clip with storage for every frame of the stack at 24 fps
+dev5::anim_clip_t make_clip(FbxAnimStack* anim_stack, int joint_count)
+{
+	dev5::anim_clip_t anim_clip;
+
+	FbxTime timer = anim_stack->GetLocalTimeSpan().GetDuration();
+	int frame_count = (int)timer.GetFrameCount(FbxTime::eFrames24);
+	anim_clip.duration = (float)timer.GetSecondDouble();
+	anim_clip.frame_count = frame_count;
+	anim_clip.joint_count = joint_count;
+	anim_clip.time_storage.resize(frame_count);
+	anim_clip.transform_storage.resize((size_t)frame_count * joint_count);
+	return anim_clip;
+}
+
+// Evaluates frames [begin, end) of the current stack of the scene that
+// nodes belong to, nodes[j] is the node of joint j. Bakes parent relative
+// transforms, the root keeps its model space transform.
+void bake_frames(const std::vector<FbxNode*>& nodes, const fbx_joint_set& bind_pose, FbxTime start, int begin, int end, dev5::anim_clip_t& anim_clip)
+{
+	int joint_count = (int)nodes.size();
+
+	FbxTime frame_time;
+	for (int frame = begin; frame < end; ++frame)
+	{
+		// clip times start at 0, the stack is evaluated from its start
+		frame_time.SetFrame(frame, FbxTime::eFrames24);
+		anim_clip.time_storage[frame] = (float)frame_time.GetSecondDouble();
+		frame_time += start;
+
+		for (int j = 0; j < joint_count; ++j)
+		{
+			float4x4& transform = anim_clip.transform_storage[(size_t)frame * joint_count + j];
+			if (bind_pose[j].parent < 0)
+				transform = to_lh_float4x4(nodes[j]->EvaluateGlobalTransform(frame_time));
+			else
+				transform = to_lh_float4x4(nodes[j]->EvaluateLocalTransform(frame_time));
+		}
+	}
+}
+
+// Bakes the animation stacks of lScene, imported from filename, into one
+// clip each. FBX SDK objects may only be used by one thread at a time, so
+// the frames are split over workers that each import their own copy of
+// the file and find the joints in it by node index, the import order being
+// the same every time. The first worker runs on this thread with lScene.
+// Frames of a worker that can not import the file, or finds other nodes
+// there, are baked here after.
+std::vector<dev5::anim_clip_t> bake_stacks(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose, const std::vector<int>& stacks)
+{
+	int joint_count = (int)bind_pose.size();
+
+	std::vector<dev5::anim_clip_t> clips;
+	std::vector<FbxTime> starts;
+	size_t sample_count = 0;
+	for (int stack : stacks)
+	{
+		FbxAnimStack* anim_stack = lScene->GetSrcObject<FbxAnimStack>(stack);
+		clips.push_back(make_clip(anim_stack, joint_count));
+		starts.push_back(anim_stack->GetLocalTimeSpan().GetStart());
+		sample_count += (size_t)clips.back().frame_count * joint_count;
+	}
+
+	unsigned thread_count = (unsigned)std::min<size_t>(MeshUtils::DefaultThreadCount(),
+		std::max<size_t>(1, sample_count / PARALLEL_BAKE_MIN_SAMPLES));
+
+	// every clip split in thread_count ranges, worker major so worker t
+	// gets the t-th range of each clip and about the same frame count
+	std::vector<bake_range_t> ranges;
+	for (unsigned t = 0; t < thread_count; ++t)
+	{
+		for (int c = 0; c < (int)clips.size(); ++c)
+		{
+			size_t frame_count = (size_t)clips[c].frame_count;
+			ranges.push_back({ c, (int)(frame_count * t / thread_count), (int)(frame_count * (t + 1) / thread_count) });
+		}
+	}
+
+	std::vector<int> node_indices(joint_count);
+	{
+		std::unordered_map<const FbxNode*, int> node_lookup;
+		for (int i = 0; i < lScene->GetNodeCount(); ++i)
+			node_lookup.emplace(lScene->GetNode(i), i);
+		for (int j = 0; j < joint_count; ++j)
+			node_indices[j] = node_lookup.at(bind_pose[j].node);
+	}
+
+	// false when scene does not have the joints at the indices of lScene
+	auto bake_ranges = [&](FbxScene* scene, size_t begin, size_t end)
+	{
+		std::vector<FbxNode*> nodes(joint_count);
+		for (int j = 0; j < joint_count; ++j)
+		{
+			nodes[j] = scene->GetNode(node_indices[j]);
+			if (!nodes[j] || strcmp(nodes[j]->GetName(), bind_pose[j].node->GetName()) != 0)
+				return false;
+		}
+
+		for (size_t r = begin; r < end; ++r)
+		{
+			const bake_range_t& range = ranges[r];
+			// the evaluator follows the scene's current stack
+			FbxAnimStack* anim_stack = scene->GetSrcObject<FbxAnimStack>(stacks[range.clip]);
+			if (scene->GetCurrentAnimationStack() != anim_stack)
+				scene->SetCurrentAnimationStack(anim_stack);
+			bake_frames(nodes, bind_pose, starts[range.clip], range.begin, range.end, clips[range.clip]);
+		}
+		return true;
+	};
+
+	FbxAnimStack* current = lScene->GetCurrentAnimationStack();
+	std::vector<std::pair<size_t, size_t>> skipped(thread_count, { 0, 0 });
+
+	MeshUtils::ParallelFor(ranges.size(), thread_count, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		if (chunk == 0)
+		{
+			bake_ranges(lScene, begin, end);
+			return;
+		}
+		if (begin == end)
+			return;
+
+		FbxManager* manager = CreateFBXManager();
+		FbxScene* scene = LoadFBXScene(manager, filename.c_str());
+		if (!scene || !bake_ranges(scene, begin, end))
+			skipped[chunk] = { begin, end };
+		manager->Destroy();
+	});
+
+	for (const auto& range : skipped)
+		bake_ranges(lScene, range.first, range.second);
+
+	lScene->SetCurrentAnimationStack(current);
+	return clips;
+}
+
+// Bakes the scene's current animation stack, see bake_stacks
+dev5::anim_clip_t LoadAnimationClip(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose)
+{
+	FbxAnimStack* current = lScene->GetCurrentAnimationStack();
+
+	int stack_count = lScene->GetSrcObjectCount<FbxAnimStack>();
+	for (int i = 0; i < stack_count; ++i)
+	{
+		if (lScene->GetSrcObject<FbxAnimStack>(i) == current)
+			return move(bake_stacks(filename, lScene, bind_pose, { i }).front());
+	}
+	return dev5::anim_clip_t();
+}
+
+// Bakes every animation stack of the scene in one bake_stacks call, so
+// each worker imports the file once and takes its share of every stack
+dev5::clip_library_t LoadClipLibrary(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose)
+{
+	dev5::clip_library_t library;
+
+	std::vector<int> stacks;
+	int stack_count = lScene->GetSrcObjectCount<FbxAnimStack>();
+	for (int i = 0; i < stack_count; ++i)
+	{
+		library.names.push_back(lScene->GetSrcObject<FbxAnimStack>(i)->GetName());
+		stacks.push_back(i);
+	}
+	library.clips = bake_stacks(filename, lScene, bind_pose, stacks);
+	return library;
+}
+
+// Add FBX mesh process function declaration here
+FbxMesh* ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, std::string& textureFilename);
+void LoadAnimationClipCached(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose, anim_clip_t& anim_clip);
+void LoadClipLibraryCached(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose, clip_library_t& library);
+
 void LoadFBX(const std::string& filename, SimpleMesh<SimpleVertex>& simpleMesh, std::string& textureFilename)
 {
 	// Create a scene
@@ -169,11 +356,18 @@ void LoadFBX(const std::string& filename, SimpleMesh<SimpleVertex>& simpleMesh,
 	FbxMesh* mesh = ProcessFBXMesh(lScene->GetRootNode(), simpleMesh, textureFilename);
 
 	// Optimize the mesh
-	MeshUtils::Compactify(simpleMesh);
+	MeshUtils::CompactifyParallel(simpleMesh);
+	MeshUtils::OptimizeVertexCache(simpleMesh);
+	if (optimizeOverdraw)
+		MeshUtils::OptimizeOverdraw(simpleMesh);
+	MeshUtils::OptimizeVertexFetch(simpleMesh);
 
 	// Convert vertex data from right-hand to left-hand coordinates
 	MeshUtils::rh_to_lh_coord(simpleMesh);
 
+	// Use 16 bit indices when the vertex count allows
+	MeshUtils::CompactIndices(simpleMesh);
+
 	// Destroy the (no longer needed) scene
 	lScene->Destroy();
 }
@@ -188,59 +382,196 @@ using influence_set_t = std::array< influence_t, 4 >;
 
 using influence_buffer_t = std::vector<influence_set_t>;
 
-influence_buffer_t get_influence_buffer(FbxMesh* mesh)
+// influences kept per vertex, the rest are dropped and the weights renormalized
+const int MAX_INFLUENCES = (int)std::tuple_size<influence_set_t>::value;
+
+// Below this many cluster weights the thread start up costs more than it saves
+const size_t PARALLEL_SKIN_MIN_INFLUENCES = 1 << 16;
+
+using joint_lookup_t = std::unordered_map<const FbxNode*, int>;
+
+// node to joint index map, built once per skeleton instead of searching
+// the bind pose for every cluster link
+joint_lookup_t make_joint_lookup(const fbx_joint_set& bind_pose)
 {
-	fbx_joint_set bind_pose = get_bindpose(*mesh);
+	joint_lookup_t lookup;
+	lookup.reserve(bind_pose.size());
 
+	for (int j = 0; j < (int)bind_pose.size(); ++j)
+		lookup.emplace(bind_pose[j].node, j);
+
+	return lookup;
+}
+
+// Builds the skeleton shared by the mesh and its clips. The bind pose of a
+// joint is the link transform its skin cluster was bound with, joints
+// without a cluster use their default global transform.
+std::shared_ptr<skeleton_t> make_skeleton(FbxMesh* mesh, const fbx_joint_set& bind_pose)
+{
+	auto skeleton = std::make_shared<skeleton_t>();
+
+	int joint_count = (int)bind_pose.size();
+	skeleton->names.resize(joint_count);
+	skeleton->parents.resize(joint_count);
+	skeleton->bind_pose.resize(joint_count);
+
+	for (int j = 0; j < joint_count; ++j)
+	{
+		skeleton->names[j] = bind_pose[j].node->GetName();
+		skeleton->parents[j] = bind_pose[j].parent;
+		skeleton->bind_pose[j] = to_lh_float4x4(bind_pose[j].node->EvaluateGlobalTransform());
+	}
+
+	joint_lookup_t joint_lookup = make_joint_lookup(bind_pose);
+	FbxSkin* skin = mesh_skin(*mesh);
+	for (int c = 0; skin && c < skin->GetClusterCount(); ++c)
+	{
+		FbxCluster* cluster = skin->GetCluster(c);
+		auto joint = joint_lookup.find(cluster->GetLink());
+		if (joint == joint_lookup.end())
+			continue;
+
+		FbxAMatrix link;
+		cluster->GetTransformLinkMatrix(link);
+		skeleton->bind_pose[joint->second] = to_lh_float4x4(link);
+	}
+
+	skeleton->compute_inverse_bind_pose();
+	return skeleton;
+}
+
+struct skin_import_stats_t
+{
+	int control_points = 0;
+	int influences = 0;				// non zero cluster weights
+	int dropped = 0;				// influences past MAX_INFLUENCES
+	int control_points_dropped = 0;	// control points that lost at least one
+	float max_dropped_weight = 0.0f;	// largest weight share lost by one control point
+	int unweighted = 0;				// control points without any influence
+	int unmapped_clusters = 0;		// cluster links outside the skeleton, skipped
+};
+
+// Per polygon vertex skin influences, strongest first and normalized.
+// Cluster weights are bucketed by control point with a counting sort and
+// each bucket is reduced to the MAX_INFLUENCES strongest in parallel, so
+// the cost is linear in the number of weights. Ties keep cluster order,
+// the output does not depend on the thread count.
+influence_buffer_t get_influence_buffer(FbxMesh* mesh, const fbx_joint_set& bind_pose, skin_import_stats_t* stats = nullptr)
+{
 	assert(!bind_pose.empty());
 
 	FbxSkin* skin = mesh_skin(*mesh);
 
 	assert(skin);
 
-	std::vector<influence_set_t> per_ctrl_pt;
-
-	per_ctrl_pt.resize(mesh->GetControlPointsCount());
+	joint_lookup_t joint_lookup = make_joint_lookup(bind_pose);
 
+	struct cluster_source_t
+	{
+		int joint;
+		int count;
+		const int* control_points;
+		const double* weights;
+	};
+
+	skin_import_stats_t local_stats;
+	local_stats.control_points = mesh->GetControlPointsCount();
+
+	// the SDK calls stay on this thread, only the reduce below runs on workers
+	std::vector<cluster_source_t> clusters;
+	size_t weight_count = 0;
 	int cluster_count = skin->GetClusterCount();
 
 	for (int c = 0; c < cluster_count; ++c)
 	{
-		auto cluster = skin->GetCluster(c);
-
-		int joint_index = -1;
+		FbxCluster* cluster = skin->GetCluster(c);
 
-		for (int j = 0; j < bind_pose.size(); ++j)
+		auto joint = joint_lookup.find(cluster->GetLink());
+		if (joint == joint_lookup.end())
 		{
-			if (bind_pose[j].node == cluster->GetLink())
-			{
-				joint_index = j;
-				break;
-			}
+			local_stats.unmapped_clusters++;
+			continue;
 		}
 
-		assert(joint_index != -1);
+		cluster_source_t source{ joint->second, cluster->GetControlPointIndicesCount(),
+			cluster->GetControlPointIndices(), cluster->GetControlPointWeights() };
+		weight_count += source.count;
+		clusters.push_back(source);
+	}
 
-		int cpi_count = cluster->GetControlPointIndicesCount();
+	unsigned thread_count = weight_count < PARALLEL_SKIN_MIN_INFLUENCES ? 1 : MeshUtils::DefaultThreadCount();
+
+	// bucket the weights by control point straight from the cluster
+	// arrays, in cluster order so ties keep it
+	std::vector<int> bucket_start(local_stats.control_points + 1, 0);
+	for (const cluster_source_t& source : clusters)
+		for (int i = 0; i < source.count; ++i)
+			if ((float)source.weights[i] > 0.0f)
+				bucket_start[source.control_points[i] + 1]++;
+
+	for (int i = 0; i < local_stats.control_points; ++i)
+		bucket_start[i + 1] += bucket_start[i];
+
+	std::vector<influence_t> buckets(bucket_start.back());
+	{
+		std::vector<int> cursor(bucket_start.begin(), bucket_start.end() - 1);
+		for (const cluster_source_t& source : clusters)
+			for (int i = 0; i < source.count; ++i)
+				if ((float)source.weights[i] > 0.0f)
+					buckets[cursor[source.control_points[i]]++] = { (float)source.weights[i], source.joint };
+	}
+	local_stats.influences = (int)buckets.size();
 
-		auto cpi = cluster->GetControlPointIndices();
+	std::vector<influence_set_t> per_ctrl_pt(local_stats.control_points);
+	std::vector<skin_import_stats_t> thread_stats(std::max(1u, thread_count));
 
-		auto weights = cluster->GetControlPointWeights();
+	MeshUtils::ParallelFor(per_ctrl_pt.size(), thread_count, [&](size_t begin, size_t end, unsigned chunk)
+	{
+		skin_import_stats_t& ts = thread_stats[chunk];
 
-		for (int i = 0; i < cpi_count; ++i)
+		for (size_t cp = begin; cp < end; ++cp)
 		{
-			int index = cpi[i];
+			influence_t* first = buckets.data() + bucket_start[cp];
+			influence_t* last = buckets.data() + bucket_start[cp + 1];
+			int count = (int)(last - first);
+
+			if (count == 0)
+			{
+				ts.unweighted++;
+				continue;
+			}
 
-			influence_set_t& influence_set = per_ctrl_pt[index];
+			std::stable_sort(first, last, [](const influence_t& a, const influence_t& b) { return a.weight > b.weight; });
 
-			influence_t temp{ (float)weights[i], joint_index };
+			int kept = std::min(count, MAX_INFLUENCES);
+			float total = 0.0f;
+			float kept_total = 0.0f;
+			for (int i = 0; i < count; ++i)
+			{
+				total += first[i].weight;
+				if (i < kept)
+					kept_total += first[i].weight;
+			}
 
-			for (auto& inf : influence_set)
+			if (count > kept)
 			{
-				if (inf.weight < temp.weight)
-					std::swap(temp, inf);
+				ts.dropped += count - kept;
+				ts.control_points_dropped++;
+				ts.max_dropped_weight = std::max(ts.max_dropped_weight, 1.0f - kept_total / total);
 			}
+
+			influence_set_t& influence_set = per_ctrl_pt[cp];
+			for (int i = 0; i < kept; ++i)
+				influence_set[i] = { first[i].weight / kept_total, first[i].index };
 		}
+	});
+
+	for (const skin_import_stats_t& ts : thread_stats)
+	{
+		local_stats.dropped += ts.dropped;
+		local_stats.control_points_dropped += ts.control_points_dropped;
+		local_stats.max_dropped_weight = std::max(local_stats.max_dropped_weight, ts.max_dropped_weight);
+		local_stats.unweighted += ts.unweighted;
 	}
 
 	int poly_vert_count = mesh->GetPolygonVertexCount();
@@ -256,19 +587,32 @@ influence_buffer_t get_influence_buffer(FbxMesh* mesh)
 		result[i] = per_ctrl_pt[point_index];
 	}
 
-	return std::move(result);
+	if (stats)
+		*stats = local_stats;
+
+	return result;
 }
 
-void LoadFBXAnimation(const std::string& filename, SimpleMesh<SkinnedVertex>& skinnedMesh, std::string& textureFilename, anim_clip_t& anim_clip)
+influence_buffer_t get_influence_buffer(FbxMesh* mesh)
 {
-	// Create a scene
-	FbxScene* lScene = LoadFBXScene(filename.c_str());
+	return get_influence_buffer(mesh, get_bindpose(*mesh));
+}
 
-	SimpleMesh<SimpleVertex> simpleMesh;
-	// Process the scene and build DirectX Arrays
-	FbxMesh* mesh = ProcessFBXMesh(lScene->GetRootNode(), simpleMesh, textureFilename);
-	auto inf_buffer = get_influence_buffer(mesh);
+void print_skin_import_stats(const skin_import_stats_t& stats)
+{
+	cout << "\nSkin: " << stats.influences << " influences on " << stats.control_points << " control points, "
+		<< stats.dropped << " dropped on " << stats.control_points_dropped << " control points"
+		<< " (max weight lost " << stats.max_dropped_weight * 100.0f << "%), "
+		<< stats.unweighted << " unweighted";
+	if (stats.unmapped_clusters > 0)
+		cout << ", " << stats.unmapped_clusters << " clusters outside the skeleton";
+	cout << endl;
+}
 
+// Builds the expanded (unindexed) skinned mesh from the processed
+// simple mesh and the per polygon vertex skin influences
+void ExpandSkinnedMesh(const influence_buffer_t& inf_buffer, SimpleMesh<SimpleVertex>& simpleMesh, SimpleMesh<SkinnedVertex>& skinnedMesh)
+{
 	MeshUtils::copy(skinnedMesh, simpleMesh);
 
 	for (int i = 0; i < skinnedMesh.vertexList.size(); i++)
@@ -276,20 +620,142 @@ void LoadFBXAnimation(const std::string& filename, SimpleMesh<SkinnedVertex>& sk
 		skinnedMesh.vertexList[i].indices = { inf_buffer[i][0].index, inf_buffer[i][1].index, inf_buffer[i][2].index, inf_buffer[i][3].index };
 		skinnedMesh.vertexList[i].weights = { inf_buffer[i][0].weight, inf_buffer[i][1].weight, inf_buffer[i][2].weight, inf_buffer[i][3].weight };
 	}
+}
+
+void ExpandSkinnedMesh(FbxMesh* mesh, SimpleMesh<SimpleVertex>& simpleMesh, SimpleMesh<SkinnedVertex>& skinnedMesh)
+{
+	ExpandSkinnedMesh(get_influence_buffer(mesh), simpleMesh, skinnedMesh);
+}
+
+// Builds the optimized skinned mesh of a scene and returns its FbxMesh
+// along with the joint set shared by the skin weights and the clips. With
+// palettes the mesh is split into submeshes that each fit the skinning
+// shader's joint palette, their vertices then index palette entries.
+FbxMesh* ProcessSkinnedMesh(FbxScene* lScene, SimpleMesh<SkinnedVertex>& skinnedMesh, std::string& textureFilename, fbx_joint_set& bind_pose, JointPalettes* palettes = nullptr)
+{
+	SimpleMesh<SimpleVertex> simpleMesh;
+	// Process the scene and build DirectX Arrays
+	FbxMesh* mesh = ProcessFBXMesh(lScene->GetRootNode(), simpleMesh, textureFilename);
+
+	bind_pose = get_bindpose(*mesh);
+	skin_import_stats_t skin_stats;
+	ExpandSkinnedMesh(get_influence_buffer(mesh, bind_pose, &skin_stats), simpleMesh, skinnedMesh);
+	print_skin_import_stats(skin_stats);
 
 	// Optimize the mesh
-	MeshUtils::Compactify(skinnedMesh);
+	MeshUtils::CompactifyParallel(skinnedMesh);
+	MeshUtils::OptimizeVertexCache(skinnedMesh);
+	MeshUtils::OptimizeVertexFetch(skinnedMesh);
 
 	// Convert vertex data from right-hand to left-hand coordinates
 	MeshUtils::rh_to_lh_coord(skinnedMesh);
 
-	//Load animation data
-	anim_clip = LoadAnimationClip(lScene, mesh);
+	if (palettes)
+	{
+		MeshUtils::SplitByJointPalette(skinnedMesh, (int)bind_pose.size(), *palettes);
+		MeshUtils::CompactSubMeshIndices(skinnedMesh);
+		cout << "Joint palettes: " << palettes->subMeshes.size() << " for " << bind_pose.size() << " joints, largest "
+			<< palettes->MaxPaletteCount() << " of " << MAX_PALETTE_JOINTS << endl;
+	}
+	else
+	{
+		// Use 16 bit indices when the vertex count allows
+		MeshUtils::CompactIndices(skinnedMesh);
+	}
+
+	return mesh;
+}
+
+void LoadFBXAnimation(const std::string& filename, SimpleMesh<SkinnedVertex>& skinnedMesh, std::string& textureFilename, anim_clip_t& anim_clip)
+{
+	// Create a scene
+	FbxScene* lScene = LoadFBXScene(filename.c_str());
+
+	fbx_joint_set bind_pose;
+	FbxMesh* mesh = ProcessSkinnedMesh(lScene, skinnedMesh, textureFilename, bind_pose);
+
+	//Load animation data, baked to a .clip file on the first run
+	LoadAnimationClipCached(filename, lScene, bind_pose, anim_clip);
+
+	// The clip only holds transform tracks, the hierarchy and bind pose
+	// live in the skeleton it references
+	anim_clip.skeleton = make_skeleton(mesh, bind_pose);
+	assert(anim_clip.joint_count == anim_clip.skeleton->joint_count());
 
 	// Destroy the (no longer needed) scene
 	lScene->Destroy();
 }
 
+// Loads a skinned mesh and every clip of the file into a library sharing
+// one skeleton, the clips are baked to a single .clips file on the first run.
+// See ProcessSkinnedMesh for palettes.
+void LoadFBXAnimation(const std::string& filename, SimpleMesh<SkinnedVertex>& skinnedMesh, std::string& textureFilename, clip_library_t& library, JointPalettes* palettes = nullptr)
+{
+	FbxScene* lScene = LoadFBXScene(filename.c_str());
+
+	fbx_joint_set bind_pose;
+	FbxMesh* mesh = ProcessSkinnedMesh(lScene, skinnedMesh, textureFilename, bind_pose, palettes);
+
+	LoadClipLibraryCached(filename, lScene, bind_pose, library);
+
+	library.skeleton = make_skeleton(mesh, bind_pose);
+	for (anim_clip_t& clip : library.clips)
+	{
+		clip.skeleton = library.skeleton;
+		assert(clip.joint_count == library.skeleton->joint_count());
+	}
+
+	lScene->Destroy();
+}
+
+// Loads a skinned mesh with 8 bit joint indices and unorm8 weights, false
+// when a vertex references a joint the 8 bit indices can not hold (a
+// skeleton of more than 256 joints loaded without palettes)
+bool LoadFBXAnimation(const std::string& filename, SimpleMesh<SkinnedVertexCompact>& compactMesh, std::string& textureFilename, anim_clip_t& anim_clip)
+{
+	SimpleMesh<SkinnedVertex> skinnedMesh;
+	LoadFBXAnimation(filename, skinnedMesh, textureFilename, anim_clip);
+	if (!MeshUtils::CompressSkinning(skinnedMesh, compactMesh))
+	{
+		cout << filename << ": joint indices do not fit in 8 bits" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool LoadFBXAnimation(const std::string& filename, SimpleMesh<SkinnedVertexCompact>& compactMesh, std::string& textureFilename, clip_library_t& library, JointPalettes* palettes = nullptr)
+{
+	SimpleMesh<SkinnedVertex> skinnedMesh;
+	LoadFBXAnimation(filename, skinnedMesh, textureFilename, library, palettes);
+	if (!MeshUtils::CompressSkinning(skinnedMesh, compactMesh))
+	{
+		cout << filename << ": joint indices do not fit in 8 bits" << endl;
+		return false;
+	}
+	return true;
+}
+
+// Compares the hashed and brute force Compactify on the expanded
+// mesh of an FBX file (and its skinned version when it has a skin)
+void BenchmarkCompactifyFBX(const std::string& filename)
+{
+	FbxScene* lScene = LoadFBXScene(filename.c_str());
+
+	SimpleMesh<SimpleVertex> simpleMesh;
+	std::string textureFilename;
+	FbxMesh* mesh = ProcessFBXMesh(lScene->GetRootNode(), simpleMesh, textureFilename);
+
+	MeshUtils::BenchmarkCompactify(simpleMesh, filename.c_str());
+
+	if (mesh && mesh_skin(*mesh))
+	{
+		SimpleMesh<SkinnedVertex> skinnedMesh;
+		ExpandSkinnedMesh(mesh, simpleMesh, skinnedMesh);
+		MeshUtils::BenchmarkCompactify(skinnedMesh, (filename + " (skinned)").c_str());
+	}
+
+	lScene->Destroy();
+}
 
 string getFileName(const string& s)
 {
@@ -322,6 +788,118 @@ void replaceExt(string& s, const string& newExt) {
 	}
 }
 
+// Maps the baked .mesh file next to an FBX, importing and baking it first
+// when it is missing or stale. The bake runs LoadFBX, builds the clusters
+// and LOD chain and, when packed, encodes PackedVertex16 vertices with
+// their PackedVertexBounds as the decode data.
+bool LoadMeshCached(const std::string& filename, bool packed, MeshCacheView& cache)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::string cachePath = filename;
+	replaceExt(cachePath, "mesh");
+
+	MeshCacheKey key;
+	key.sourceHash = CacheUtils::HashFile(filename);
+	key.importerVersion = MESH_IMPORTER_VERSION;
+	key.flags = optimizeOverdraw ? MESH_CACHE_OVERDRAW_OPTIMIZED : 0;
+	key.importScale = scale;
+	key.vertexStride = packed ? sizeof(PackedVertex16) : sizeof(SimpleVertex);
+
+	if (CacheUtils::OpenMeshCache(cachePath, key, cache))
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+		cout << "Mesh cache " << cachePath << ": mapped in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+		return true;
+	}
+
+	SimpleMesh<SimpleVertex> mesh;
+	std::string textureFilename;
+	vector<MeshCluster> clusters;
+	vector<MeshLod> lods;
+
+	LoadFBX(filename, mesh, textureFilename);
+	MeshUtils::BuildMeshClusters(mesh, clusters);
+	MeshUtils::GenerateLods(mesh, lods);
+
+	bool written = false;
+	if (packed)
+	{
+		SimpleMesh<PackedVertex16> packedMesh;
+		PackedVertexBounds bounds;
+		MeshUtils::EncodePackedVertices(mesh, packedMesh, bounds);
+		written = CacheUtils::WriteMeshCache(cachePath, key, packedMesh, textureFilename, clusters, lods, &bounds, sizeof(bounds));
+	}
+	else
+	{
+		written = CacheUtils::WriteMeshCache(cachePath, key, mesh, textureFilename, clusters, lods);
+	}
+
+	if (!written || !CacheUtils::OpenMeshCache(cachePath, key, cache))
+	{
+		cout << "Mesh cache " << cachePath << ": could not be written" << endl;
+		return false;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << "Mesh cache " << cachePath << ": baked in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+	return true;
+}
+
+// Maps the baked .clip file next to an FBX into anim_clip, the clip is only
+// evaluated through the FBX SDK (and baked) when that file is missing or stale
+void LoadAnimationClipCached(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose, anim_clip_t& anim_clip)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::string cachePath = filename;
+	replaceExt(cachePath, "clip");
+	uint64_t sourceHash = CacheUtils::HashFile(filename);
+
+	if (CacheUtils::OpenAnimClipCache(cachePath, sourceHash, ANIM_IMPORTER_VERSION, anim_clip))
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+		cout << "Clip cache " << cachePath << ": mapped in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+		return;
+	}
+
+	anim_clip = LoadAnimationClip(filename, lScene, bind_pose);
+	if (!CacheUtils::WriteAnimClipCache(cachePath, sourceHash, ANIM_IMPORTER_VERSION, anim_clip))
+	{
+		cout << "Clip cache " << cachePath << ": could not be written" << endl;
+		return;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << "Clip cache " << cachePath << ": baked in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+}
+
+// Maps the baked .clips file next to an FBX into library, every animation
+// stack is only evaluated (and baked) when that file is missing or stale
+void LoadClipLibraryCached(const std::string& filename, FbxScene* lScene, const fbx_joint_set& bind_pose, clip_library_t& library)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::string cachePath = filename;
+	replaceExt(cachePath, "clips");
+	uint64_t sourceHash = CacheUtils::HashFile(filename);
+
+	const char* action = "mapped";
+	if (!CacheUtils::OpenClipLibraryCache(cachePath, sourceHash, ANIM_IMPORTER_VERSION, library))
+	{
+		action = "baked";
+		library = LoadClipLibrary(filename, lScene, bind_pose);
+		if (!CacheUtils::WriteClipLibraryCache(cachePath, sourceHash, ANIM_IMPORTER_VERSION, library))
+			cout << "Clip library " << cachePath << ": could not be written" << endl;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << "Clip library " << cachePath << ": " << library.clips.size() << " clips " << action << " in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+	for (size_t i = 0; i < library.clips.size(); i++)
+		cout << "  " << library.names[i] << ": " << library.clips[i].frame_count << " frames, " << library.clips[i].duration << " s" << endl;
+}
+
 FbxMesh* ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, std::string& textureFilename)
 {
 	int childrenCount = Node->GetChildCount();
@@ -492,4 +1070,184 @@ FbxMesh* ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, std
 			mesh = ProcessFBXMesh(childNode, simpleMesh, textureFilename);
 	}
 	return mesh;
-}
\ No newline at end of file
+}
+// Diffuse texture of a material as a .dds file name, "" when it has none
+std::string GetMaterialTexture(FbxSurfaceMaterial* material)
+{
+	FbxProperty prop = material->FindProperty(FbxSurfaceMaterial::sDiffuse);
+	FbxFileTexture* texture = nullptr;
+
+	// first texture of the first layer for layered textures
+	if (prop.GetSrcObjectCount<FbxLayeredTexture>() > 0)
+	{
+		FbxLayeredTexture* layered_texture = prop.GetSrcObject<FbxLayeredTexture>(0);
+		if (layered_texture->GetSrcObjectCount<FbxTexture>() > 0)
+			texture = FbxCast<FbxFileTexture>(layered_texture->GetSrcObject<FbxTexture>(0));
+	}
+	else if (prop.GetSrcObjectCount<FbxTexture>() > 0)
+		texture = FbxCast<FbxFileTexture>(prop.GetSrcObject<FbxTexture>(0));
+
+	if (texture == nullptr)
+		return "";
+
+	// strip out the path and change the file extension
+	std::string textureFilename = texture->GetFileName();
+	std::string name = getFileName(textureFilename);
+	if (name == "")
+		name = textureFilename;
+	replaceExt(name, "dds");
+	return name;
+}
+
+void CollectMeshNodes(FbxNode* node, vector<FbxNode*>& meshNodes)
+{
+	if (node->GetMesh() != nullptr)
+		meshNodes.push_back(node);
+
+	for (int i = 0; i < node->GetChildCount(); i++)
+		CollectMeshNodes(node->GetChild(i), meshNodes);
+}
+
+// Expands the polygons of a mesh node into one triangle list per material
+// slot, new slots are added to materials as they are found. Unlike
+// ProcessFBXMesh the node transform is applied, since the meshes of a
+// file share one world matrix once they are in the same vertex buffer.
+void ExpandFBXMeshByMaterial(FbxNode* node, vector<FbxSurfaceMaterial*>& slotMaterials, vector<MeshMaterial>& materials, vector<SimpleMesh<SimpleVertex>>& parts)
+{
+	FbxMesh* mesh = node->GetMesh();
+
+	FbxAMatrix geometry(node->GetGeometricTranslation(FbxNode::eSourcePivot),
+		node->GetGeometricRotation(FbxNode::eSourcePivot),
+		node->GetGeometricScaling(FbxNode::eSourcePivot));
+	FbxAMatrix transform = node->EvaluateGlobalTransform() * geometry;
+	// a mirroring transform turns the triangles inside out, their
+	// winding is flipped back below
+	bool mirrored = transform.Determinant() < 0.0;
+
+	// normals use the inverse transpose of the linear part
+	FbxAMatrix linear = transform;
+	linear.SetT(FbxVector4(0.0, 0.0, 0.0, 0.0));
+	FbxAMatrix normalTransform = linear.Inverse().Transpose();
+
+	FbxArray<FbxVector4> normalsVec;
+	mesh->GetPolygonVertexNormals(normalsVec);
+
+	FbxStringList lUVSetNameList;
+	mesh->GetUVSetNames(lUVSetNameList);
+	const FbxGeometryElementUV* lUVElement = lUVSetNameList.GetCount() > 0 ? mesh->GetElementUV(lUVSetNameList.GetStringAt(0)) : nullptr;
+
+	const FbxGeometryElementMaterial* materialElement = mesh->GetElementMaterial();
+	bool materialByPolygon = materialElement != nullptr && materialElement->GetMappingMode() == FbxGeometryElement::eByPolygon;
+
+	auto makeVertex = [&](int polygonVertex, int controlPoint)
+	{
+		SimpleVertex v = {};
+
+		FbxVector4 pos = transform.MultT(mesh->GetControlPointAt(controlPoint));
+		v.Pos.x = (float)pos[0] * scale;
+		v.Pos.y = (float)pos[1] * scale;
+		v.Pos.z = (float)pos[2] * scale;
+
+		if (polygonVertex < normalsVec.Size())
+		{
+			FbxVector4 normal = normalTransform.MultT(normalsVec.GetAt(polygonVertex));
+			normal.Normalize();
+			v.Normal.x = (float)normal[0];
+			v.Normal.y = (float)normal[1];
+			v.Normal.z = (float)normal[2];
+		}
+
+		if (lUVElement != nullptr)
+		{
+			int uvIndex = lUVElement->GetMappingMode() == FbxLayerElement::eByControlPoint ? controlPoint : polygonVertex;
+			if (lUVElement->GetReferenceMode() == FbxLayerElement::eIndexToDirect)
+				uvIndex = lUVElement->GetIndexArray().GetAt(uvIndex);
+
+			FbxVector2 lUVValue = lUVElement->GetDirectArray().GetAt(uvIndex);
+			v.Tex.x = (float)lUVValue[0];
+			v.Tex.y = 1.0f - (float)lUVValue[1];
+		}
+		return v;
+	};
+
+	int polygonCount = mesh->GetPolygonCount();
+	for (int p = 0; p < polygonCount; p++)
+	{
+		int nodeMaterial = materialByPolygon ? materialElement->GetIndexArray().GetAt(p) : 0;
+		FbxSurfaceMaterial* material = node->GetMaterial(nodeMaterial);
+
+		uint32_t slot = (uint32_t)(std::find(slotMaterials.begin(), slotMaterials.end(), material) - slotMaterials.begin());
+		if (slot == slotMaterials.size())
+		{
+			slotMaterials.push_back(material);
+			MeshMaterial meshMaterial;
+			if (material != nullptr)
+			{
+				meshMaterial.name = material->GetName();
+				meshMaterial.textureFilename = GetMaterialTexture(material);
+			}
+			materials.push_back(meshMaterial);
+		}
+		if (parts.size() <= slot)
+			parts.resize(slot + 1);
+
+		// triangulate as a fan, the expanded vertices are welded later
+		SimpleMesh<SimpleVertex>& part = parts[slot];
+		int start = mesh->GetPolygonVertexIndex(p);
+		int size = mesh->GetPolygonSize(p);
+		for (int k = 1; k + 1 < size; k++)
+		{
+			int corners[3] = { 0, mirrored ? k + 1 : k, mirrored ? k : k + 1 };
+			for (int corner : corners)
+			{
+				part.indicesList.push_back((int)part.vertexList.size());
+				part.vertexList.push_back(makeVertex(start + corner, mesh->GetPolygonVertex(p, corner)));
+			}
+		}
+	}
+}
+
+// Imports every mesh of a file into one shared vertex and index buffer,
+// with one submesh per mesh node and material. Each submesh runs through
+// the LoadFBX passes on its own so its indices stay local to it.
+void LoadFBXMultiMesh(const std::string& filename, SimpleMesh<SimpleVertex>& sharedMesh, vector<SubMesh>& subMeshes, vector<MeshMaterial>& materials)
+{
+	FbxScene* lScene = LoadFBXScene(filename.c_str());
+
+	vector<FbxNode*> meshNodes;
+	CollectMeshNodes(lScene->GetRootNode(), meshNodes);
+
+	vector<FbxSurfaceMaterial*> slotMaterials;
+	for (FbxNode* node : meshNodes)
+	{
+		vector<SimpleMesh<SimpleVertex>> parts;
+		ExpandFBXMeshByMaterial(node, slotMaterials, materials, parts);
+
+		for (uint32_t slot = 0; slot < parts.size(); slot++)
+		{
+			SimpleMesh<SimpleVertex>& part = parts[slot];
+			if (part.indicesList.empty())
+				continue;
+
+			MeshUtils::CompactifyParallel(part);
+			MeshUtils::OptimizeVertexCache(part);
+			if (optimizeOverdraw)
+				MeshUtils::OptimizeOverdraw(part);
+			MeshUtils::OptimizeVertexFetch(part);
+			MeshUtils::rh_to_lh_coord(part);
+
+			MeshUtils::AppendSubMesh(sharedMesh, subMeshes, part, slot);
+		}
+	}
+
+	// group submeshes by material so the renderer switches textures less,
+	// each keeps its own base vertex so they can be drawn in any order
+	std::stable_sort(subMeshes.begin(), subMeshes.end(), [](const SubMesh& a, const SubMesh& b) { return a.materialSlot < b.materialSlot; });
+
+	MeshUtils::CompactSubMeshIndices(sharedMesh);
+
+	cout << "\n" << filename << ": " << meshNodes.size() << " meshes, " << materials.size() << " materials, "
+		<< subMeshes.size() << " submeshes, " << sharedMesh.vertexList.size() << " vertices" << endl;
+
+	lScene->Destroy();
+}
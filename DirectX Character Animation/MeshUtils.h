@@ -1,6 +1,21 @@
 #pragma once
 #include <directxmath.h>
 #include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+#include <emmintrin.h>
+#include <cassert>
+#include <istream>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <iterator>
 
 using namespace std;
 using namespace DirectX;
@@ -11,7 +26,7 @@ struct SimpleVertex
 	XMFLOAT3 Normal;
 	XMFLOAT2 Tex;
 
-	bool inline operator==(const SimpleVertex& rhs)
+	bool inline operator==(const SimpleVertex& rhs) const
 	{
 		return (Pos.x == rhs.Pos.x &&
 			Pos.y == rhs.Pos.y &&
@@ -33,7 +48,7 @@ struct SkinnedVertex
 	XMFLOAT4 weights = { 0.0f, 0.0f, 0.0f, 0.0f };
 	XMINT4 indices = { 0,0,0,0 };
 
-	bool inline operator==(const SkinnedVertex& rhs)
+	bool inline operator==(const SkinnedVertex& rhs) const
 	{
 		return (Pos.x == rhs.Pos.x &&
 			Pos.y == rhs.Pos.y &&
@@ -55,17 +70,219 @@ struct SkinnedVertex
 	}
 };
 
+// SkinnedVertex with 8 bit joint indices and unorm8 weights that sum to
+// exactly 255, the skinning data is 8 bytes instead of 32
+struct SkinnedVertexCompact
+{
+	XMFLOAT3 Pos;
+	XMFLOAT3 Normal;
+	XMFLOAT2 Tex;
+	uint8_t weights[4] = { 0, 0, 0, 0 };	// R8G8B8A8_UNORM
+	uint8_t indices[4] = { 0, 0, 0, 0 };	// R8G8B8A8_UINT
+};
+
+static_assert(sizeof(SkinnedVertexCompact) == 40, "SkinnedVertexCompact must be 40 bytes");
+
+// 16 byte vertex: position quantized to the mesh bounds, octahedral
+// normal and uv quantized to the mesh uv bounds, decoded in Packed_VS
+struct PackedVertex16
+{
+	uint16_t Pos[4];	// R16G16B16A16_UNORM, w unused
+	int16_t Normal[2];	// R16G16_SNORM octahedral
+	uint16_t Tex[2];	// R16G16_UNORM
+};
+
+// 24 byte vertex: full precision position and uv, octahedral normal
+struct PackedVertex24
+{
+	XMFLOAT3 Pos;		// R32G32B32_FLOAT
+	int16_t Normal[2];	// R16G16_SNORM octahedral
+	XMFLOAT2 Tex;		// R32G32_FLOAT
+};
+
+static_assert(sizeof(PackedVertex16) == 16, "PackedVertex16 must be 16 bytes");
+static_assert(sizeof(PackedVertex24) == 24, "PackedVertex24 must be 24 bytes");
+
+// Dequantization constants for the packed formats, uploaded to
+// the PackedVertexBounds constant buffer of Packed_VS
+// decoded = min + encoded * extent
+struct PackedVertexBounds
+{
+	XMFLOAT4 posMin = { 0.0f, 0.0f, 0.0f, 0.0f };
+	XMFLOAT4 posExtent = { 1.0f, 1.0f, 1.0f, 0.0f };
+	XMFLOAT4 texMin = { 0.0f, 0.0f, 0.0f, 0.0f };
+	XMFLOAT4 texExtent = { 1.0f, 1.0f, 0.0f, 0.0f };
+};
+
+// A contiguous range of the index buffer with bounds for CPU culling
+// built by MeshUtils::BuildMeshClusters
+struct MeshCluster
+{
+	uint32_t indexStart = 0;
+	uint32_t indexCount = 0;
+	uint32_t vertexCount = 0;
+
+	// bounding sphere
+	XMFLOAT3 center = { 0.0f, 0.0f, 0.0f };
+	float radius = 0.0f;
+
+	// backface cone, the cluster faces away from any viewer for which
+	// dot(normalize(coneApex - viewer), coneAxis) >= coneCutoff
+	XMFLOAT3 coneApex = { 0.0f, 0.0f, 0.0f };
+	float coneCutoff = 1.0f;
+	XMFLOAT3 coneAxis = { 0.0f, 0.0f, 1.0f };
+	float pad = 0.0f;
+};
+
+// One level of detail, a range of the shared index buffer filled by
+// MeshUtils::GenerateLods, error is the geometric error in mesh units
+struct MeshLod
+{
+	uint32_t indexStart = 0;
+	uint32_t indexCount = 0;
+	float error = 0.0f;
+};
+
+// One mesh (or one material of a mesh) of a file imported into a shared
+// vertex and index buffer, drawn with DrawIndexed(indexCount, indexStart,
+// baseVertex). Indices are local to the submesh so each part still fits
+// 16 bit indices when it has at most 65536 vertices. A skinned submesh
+// also has its own joint palette, see JointPalettes.
+struct SubMesh
+{
+	uint32_t indexStart = 0;
+	uint32_t indexCount = 0;
+	int32_t baseVertex = 0;
+	uint32_t materialSlot = 0;
+	uint32_t paletteStart = 0;
+	uint32_t paletteCount = 0;
+};
+
+// Joints one skinned draw can reference, must match MAX_PALETTE_JOINTS in
+// Skinned_VS.hlsl
+const int MAX_PALETTE_JOINTS = 128;
+
+// Skinned mesh split into submeshes that each fit a joint palette. The
+// vertices of a submesh index its palette, entry i of which is skeleton
+// joint joints[paletteStart + i].
+struct JointPalettes
+{
+	vector<SubMesh> subMeshes;
+	vector<int> joints;
+
+	uint32_t MaxPaletteCount() const
+	{
+		uint32_t count = 0;
+		for (const SubMesh& subMesh : subMeshes)
+			count = std::max(count, subMesh.paletteCount);
+		return count;
+	}
+};
+
+// A material slot of a multi mesh file, referenced by SubMesh::materialSlot
+struct MeshMaterial
+{
+	std::string name;
+	std::string textureFilename;
+};
+
 template <typename T>
 struct SimpleMesh
 {
 	vector<T> vertexList;
 	vector<int> indicesList;
+	// 16 bit copy of the indices filled by MeshUtils::CompactIndices
+	// when the vertex count allows, indicesList is emptied when used
+	vector<uint16_t> indicesList16;
 };
 
 namespace MeshUtils
 {
+	// hash helpers used by the vertex welding pass
+	// floats are hashed by their raw bits, except -0.0f is folded
+	// into 0.0f so that vertices that compare equal also hash equal
+	inline uint32_t FloatBits(float f)
+	{
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return (bits == 0x80000000u) ? 0u : bits;
+	}
+
+	inline uint32_t HashCombine(uint32_t h, uint32_t bits)
+	{
+		// murmur3 style mixing of one 32 bit word
+		bits *= 0xcc9e2d51u;
+		bits = (bits << 15) | (bits >> 17);
+		bits *= 0x1b873593u;
+		h ^= bits;
+		h = (h << 13) | (h >> 19);
+		return h * 5u + 0xe6546b64u;
+	}
+
+	inline uint32_t HashFinalize(uint32_t h)
+	{
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	inline uint32_t HashVertex(const SimpleVertex& v)
+	{
+		uint32_t h = 0;
+		h = HashCombine(h, FloatBits(v.Pos.x));
+		h = HashCombine(h, FloatBits(v.Pos.y));
+		h = HashCombine(h, FloatBits(v.Pos.z));
+		h = HashCombine(h, FloatBits(v.Normal.x));
+		h = HashCombine(h, FloatBits(v.Normal.y));
+		h = HashCombine(h, FloatBits(v.Normal.z));
+		h = HashCombine(h, FloatBits(v.Tex.x));
+		h = HashCombine(h, FloatBits(v.Tex.y));
+		return HashFinalize(h);
+	}
+
+	inline uint32_t HashVertex(const SkinnedVertex& v)
+	{
+		uint32_t h = 0;
+		h = HashCombine(h, FloatBits(v.Pos.x));
+		h = HashCombine(h, FloatBits(v.Pos.y));
+		h = HashCombine(h, FloatBits(v.Pos.z));
+		h = HashCombine(h, FloatBits(v.Normal.x));
+		h = HashCombine(h, FloatBits(v.Normal.y));
+		h = HashCombine(h, FloatBits(v.Normal.z));
+		h = HashCombine(h, FloatBits(v.Tex.x));
+		h = HashCombine(h, FloatBits(v.Tex.y));
+		h = HashCombine(h, FloatBits(v.weights.x));
+		h = HashCombine(h, FloatBits(v.weights.y));
+		h = HashCombine(h, FloatBits(v.weights.z));
+		h = HashCombine(h, FloatBits(v.weights.w));
+		h = HashCombine(h, (uint32_t)v.indices.x);
+		h = HashCombine(h, (uint32_t)v.indices.y);
+		h = HashCombine(h, (uint32_t)v.indices.z);
+		h = HashCombine(h, (uint32_t)v.indices.w);
+		return HashFinalize(h);
+	}
+
+	template <typename T>
+	void PrintCompactifyStats(const SimpleMesh<T>& simpleMesh, size_t compactedVertexCount)
+	{
+		int numIndices = (int)simpleMesh.indicesList.size();
+		int numVertices = (int)simpleMesh.vertexList.size();
+
+		// print out some stats
+		cout << "index count BEFORE/AFTER compaction " << numIndices << endl;
+		cout << "vertex count UNOPTIMIZED (SimpleMesh In): " << numVertices << endl;
+		cout << "vertex count AFTER compaction (SimpleMesh Out): " << compactedVertexCount << endl;
+		cout << "Size reduction: " << ((numVertices - compactedVertexCount) / (float)numVertices) * 100.00f << "%" << endl;
+		cout << "or " << (compactedVertexCount / (float)numVertices) << " of the expanded size" << endl;
+	}
+
+	// Original O(n^2) welding pass, kept as the reference
+	// implementation for BenchmarkCompactify
 	template <typename T>
-	void Compactify(SimpleMesh<T>& simpleMesh)
+	void CompactifyBruteForce(SimpleMesh<T>& simpleMesh, bool printStats = true)
 	{
 		// Using vectors because we don't know what size we are
 		// going to need until the end
@@ -78,25 +295,15 @@ namespace MeshUtils
 		// for each vertex in the expanded array
 		// compare to the compacted array for a matching
 		// vertex, if found, skip adding and set the index
-		for (T vertSimpleMesh : simpleMesh.vertexList)
+		for (const T& vertSimpleMesh : simpleMesh.vertexList)
 		{
 			bool found = false;
 			int foundIndex = 0;
 			// search for match with the rest in the array
-			for (T vertCompactedList : compactedVertexList)
-			{
-				//if (vertSimpleMesh.Pos.x == vertCompactedList.Pos.x &&
-				//	vertSimpleMesh.Pos.y == vertCompactedList.Pos.y &&
-				//	vertSimpleMesh.Pos.z == vertCompactedList.Pos.z &&
-				//	vertSimpleMesh.Normal.x == vertCompactedList.Normal.x &&
-				//	vertSimpleMesh.Normal.y == vertCompactedList.Normal.y &&
-				//	vertSimpleMesh.Normal.z == vertCompactedList.Normal.z &&
-				//	vertSimpleMesh.Tex.x == vertCompactedList.Tex.x &&
-				//	vertSimpleMesh.Tex.y == vertCompactedList.Tex.y
-				//	)
+			for (const T& vertCompactedList : compactedVertexList)
+			{
 				if (vertSimpleMesh == vertCompactedList)
 				{
-					//cout << "Match at " << i << "-";
 					indicesList.push_back(foundIndex);
 					found = true;
 					break;
@@ -113,19 +320,2066 @@ namespace MeshUtils
 			}
 		}
 
-		int numIndices = (int)simpleMesh.indicesList.size();
-		int numVertices = (int)simpleMesh.vertexList.size();
+		if (printStats)
+			PrintCompactifyStats(simpleMesh, compactedVertexList.size());
 
-		// print out some stats
-		cout << "index count BEFORE/AFTER compaction " << numIndices << endl;
-		cout << "vertex count UNOPTIMIZED (SimpleMesh In): " << numVertices << endl;
-		cout << "vertex count AFTER compaction (SimpleMesh Out): " << compactedVertexList.size() << endl;
-		cout << "Size reduction: " << ((numVertices - compactedVertexList.size()) / (float)numVertices) * 100.00f << "%" << endl;
-		cout << "or " << (compactedVertexList.size() / (float)numVertices) << " of the expanded size" << endl;
+		// copy working data to the global SimpleMesh
+		simpleMesh.indicesList = std::move(indicesList);
+		simpleMesh.vertexList = std::move(compactedVertexList);
+	}
+
+	// Welds identical vertices of an expanded (unindexed) mesh using an
+	// open addressing hash table, expected O(n). Vertices are kept in
+	// first-seen order so the output matches CompactifyBruteForce exactly.
+	template <typename T>
+	void Compactify(SimpleMesh<T>& simpleMesh, bool printStats = true)
+	{
+		const size_t numVertices = simpleMesh.vertexList.size();
+
+		// power of two table at most half full
+		size_t tableSize = 16;
+		while (tableSize < numVertices * 2)
+			tableSize <<= 1;
+		const size_t tableMask = tableSize - 1;
+
+		// each slot holds an index into compactedVertexList, -1 is empty
+		vector<int> table(tableSize, -1);
+
+		vector<T> compactedVertexList;
+		compactedVertexList.reserve(numVertices);
+		vector<int> indicesList;
+		indicesList.resize(numVertices);
+
+		for (size_t i = 0; i < numVertices; i++)
+		{
+			const T& vert = simpleMesh.vertexList[i];
+			size_t slot = HashVertex(vert) & tableMask;
+
+			// linear probe until we find a match or an empty slot
+			while (table[slot] != -1 && !(compactedVertexList[table[slot]] == vert))
+				slot = (slot + 1) & tableMask;
+
+			if (table[slot] == -1)
+			{
+				table[slot] = (int)compactedVertexList.size();
+				compactedVertexList.push_back(vert);
+			}
+			indicesList[i] = table[slot];
+		}
+
+		if (printStats)
+			PrintCompactifyStats(simpleMesh, compactedVertexList.size());
+
+		// copy working data to the global SimpleMesh
+		simpleMesh.indicesList = std::move(indicesList);
+		simpleMesh.vertexList = std::move(compactedVertexList);
+	}
+
+	// Splits [0, count) into one contiguous chunk per thread and runs
+	// func(begin, end, chunkIndex) on each, blocking until all are done
+	template <typename Func>
+	void ParallelFor(size_t count, unsigned threadCount, Func func)
+	{
+		if (threadCount <= 1 || count < threadCount)
+		{
+			func((size_t)0, count, 0u);
+			return;
+		}
+
+		size_t chunkSize = (count + threadCount - 1) / threadCount;
+		vector<std::thread> workers;
+		workers.reserve(threadCount - 1);
+
+		for (unsigned t = 1; t < threadCount; t++)
+		{
+			size_t begin = std::min(count, t * chunkSize);
+			size_t end = std::min(count, begin + chunkSize);
+			workers.emplace_back(func, begin, end, t);
+		}
+		func((size_t)0, std::min(count, chunkSize), 0u);
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	inline unsigned DefaultThreadCount()
+	{
+		unsigned threads = std::thread::hardware_concurrency();
+		return threads ? threads : 1;
+	}
+
+	// Below this many corners the thread start up costs more than it saves
+	const size_t PARALLEL_COMPACTIFY_MIN_VERTICES = 1 << 16;
+
+	// Number of hash shards, fixed so the work split does not depend on the thread count
+	const unsigned COMPACTIFY_SHARD_BITS = 8;
+	const unsigned COMPACTIFY_SHARD_COUNT = 1 << COMPACTIFY_SHARD_BITS;
+
+	// Multi-threaded Compactify. The expanded vertices are bucketed by hash
+	// into shards, each shard is welded on its own thread, then a prefix sum
+	// over the first occurrences builds the global remap table. Output is
+	// identical to Compactify for any thread count. A threadCount of 0 uses
+	// every core and falls back to Compactify for small meshes.
+	template <typename T>
+	void CompactifyParallel(SimpleMesh<T>& simpleMesh, unsigned threadCount = 0, bool printStats = true)
+	{
+		const size_t numVertices = simpleMesh.vertexList.size();
+		if (threadCount == 0)
+			threadCount = (numVertices < PARALLEL_COMPACTIFY_MIN_VERTICES) ? 1 : DefaultThreadCount();
+
+		if (threadCount == 1)
+		{
+			Compactify(simpleMesh, printStats);
+			return;
+		}
+
+		const vector<T>& vertexList = simpleMesh.vertexList;
+
+		// hash every vertex and count how many land in each shard per chunk
+		vector<uint32_t> hashes(numVertices);
+		vector<int> shardCounts((size_t)threadCount * COMPACTIFY_SHARD_COUNT, 0);
+
+		ParallelFor(numVertices, threadCount, [&](size_t begin, size_t end, unsigned chunk)
+		{
+			int* counts = shardCounts.data() + (size_t)chunk * COMPACTIFY_SHARD_COUNT;
+			for (size_t i = begin; i < end; i++)
+			{
+				hashes[i] = HashVertex(vertexList[i]);
+				counts[hashes[i] >> (32 - COMPACTIFY_SHARD_BITS)]++;
+			}
+		});
+
+		// exclusive prefix sum, shard major so each shard is a contiguous
+		// range and each chunk owns an ordered sub range of it
+		vector<int> shardStart(COMPACTIFY_SHARD_COUNT + 1, 0);
+		int running = 0;
+		for (unsigned shard = 0; shard < COMPACTIFY_SHARD_COUNT; shard++)
+		{
+			shardStart[shard] = running;
+			for (unsigned chunk = 0; chunk < threadCount; chunk++)
+			{
+				int& count = shardCounts[(size_t)chunk * COMPACTIFY_SHARD_COUNT + shard];
+				int chunkCount = count;
+				count = running;
+				running += chunkCount;
+			}
+		}
+		shardStart[COMPACTIFY_SHARD_COUNT] = running;
+
+		// scatter vertex ids into their shards, ascending within each shard
+		vector<int> shardVertices(numVertices);
+		ParallelFor(numVertices, threadCount, [&](size_t begin, size_t end, unsigned chunk)
+		{
+			int* offsets = shardCounts.data() + (size_t)chunk * COMPACTIFY_SHARD_COUNT;
+			for (size_t i = begin; i < end; i++)
+				shardVertices[offsets[hashes[i] >> (32 - COMPACTIFY_SHARD_BITS)]++] = (int)i;
+		});
+
+		// weld each shard, mapping every vertex to the first vertex equal to it
+		vector<int> firstEqual(numVertices);
+		ParallelFor(COMPACTIFY_SHARD_COUNT, threadCount, [&](size_t shardBegin, size_t shardEnd, unsigned)
+		{
+			vector<int> table;
+			for (size_t shard = shardBegin; shard < shardEnd; shard++)
+			{
+				const int* ids = shardVertices.data() + shardStart[shard];
+				const size_t idCount = (size_t)(shardStart[shard + 1] - shardStart[shard]);
+
+				size_t tableSize = 16;
+				while (tableSize < idCount * 2)
+					tableSize <<= 1;
+				const size_t tableMask = tableSize - 1;
+				table.assign(tableSize, -1);
+
+				for (size_t k = 0; k < idCount; k++)
+				{
+					int id = ids[k];
+					size_t slot = hashes[id] & tableMask;
+
+					while (table[slot] != -1 && !(vertexList[table[slot]] == vertexList[id]))
+						slot = (slot + 1) & tableMask;
+
+					if (table[slot] == -1)
+						table[slot] = id;
+					firstEqual[id] = table[slot];
+				}
+			}
+		});
+
+		// stitch: number the first occurrences in order with a chunked prefix sum
+		vector<int> chunkFirstCounts(threadCount + 1, 0);
+		ParallelFor(numVertices, threadCount, [&](size_t begin, size_t end, unsigned chunk)
+		{
+			int count = 0;
+			for (size_t i = begin; i < end; i++)
+				count += (firstEqual[i] == (int)i);
+			chunkFirstCounts[chunk + 1] = count;
+		});
+		for (unsigned chunk = 0; chunk < threadCount; chunk++)
+			chunkFirstCounts[chunk + 1] += chunkFirstCounts[chunk];
+
+		const size_t compactedCount = (size_t)chunkFirstCounts[threadCount];
+		vector<T> compactedVertexList(compactedCount);
+		vector<int> remap(numVertices);
+
+		ParallelFor(numVertices, threadCount, [&](size_t begin, size_t end, unsigned chunk)
+		{
+			int next = chunkFirstCounts[chunk];
+			for (size_t i = begin; i < end; i++)
+			{
+				if (firstEqual[i] == (int)i)
+				{
+					remap[i] = next;
+					compactedVertexList[next++] = vertexList[i];
+				}
+			}
+		});
+
+		// firstEqual[i] <= i and was numbered above, so this can run in parallel
+		vector<int> indicesList(numVertices);
+		ParallelFor(numVertices, threadCount, [&](size_t begin, size_t end, unsigned)
+		{
+			for (size_t i = begin; i < end; i++)
+				indicesList[i] = remap[firstEqual[i]];
+		});
+
+		if (printStats)
+			PrintCompactifyStats(simpleMesh, compactedVertexList.size());
 
 		// copy working data to the global SimpleMesh
-		simpleMesh.indicesList = indicesList;
-		simpleMesh.vertexList = compactedVertexList;
+		simpleMesh.indicesList = std::move(indicesList);
+		simpleMesh.vertexList = std::move(compactedVertexList);
+	}
+
+	// Times the hashed Compactify against the brute force reference
+	// on a copy of an expanded mesh and checks they produce the same output
+	template <typename T>
+	bool BenchmarkCompactify(const SimpleMesh<T>& expandedMesh, const char* name)
+	{
+		using clock = std::chrono::high_resolution_clock;
+
+		SimpleMesh<T> bruteMesh = expandedMesh;
+		auto start = clock::now();
+		CompactifyBruteForce(bruteMesh, false);
+		double bruteMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		SimpleMesh<T> hashMesh = expandedMesh;
+		start = clock::now();
+		Compactify(hashMesh, false);
+		double hashMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		// pass the thread count explicitly so small meshes take the threaded path too
+		SimpleMesh<T> parallelMesh = expandedMesh;
+		unsigned threadCount = DefaultThreadCount();
+		start = clock::now();
+		CompactifyParallel(parallelMesh, threadCount, false);
+		double parallelMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		auto sameOutput = [](const SimpleMesh<T>& a, const SimpleMesh<T>& b)
+		{
+			if (a.indicesList != b.indicesList || a.vertexList.size() != b.vertexList.size())
+				return false;
+			return a.vertexList.empty() ||
+				memcmp(a.vertexList.data(), b.vertexList.data(), a.vertexList.size() * sizeof(T)) == 0;
+		};
+		bool match = sameOutput(bruteMesh, hashMesh) && sameOutput(bruteMesh, parallelMesh);
+
+		cout << "\n[Compactify benchmark] " << name << endl;
+		cout << "corners: " << expandedMesh.vertexList.size() << " welded vertices: " << hashMesh.vertexList.size() << endl;
+		cout << "brute force: " << bruteMs << " ms  hashed: " << hashMs << " ms  speedup: " << (bruteMs / (hashMs > 0.0 ? hashMs : 1e-6)) << "x" << endl;
+		cout << "parallel (" << threadCount << " threads): " << parallelMs << " ms" << endl;
+		cout << "output " << (match ? "IDENTICAL" : "MISMATCH") << endl;
+
+		return match;
+	}
+
+	// Typical post-transform cache size of current hardware
+	const int DEFAULT_VERTEX_CACHE_SIZE = 16;
+
+	// Simulated FIFO post-transform cache. A vertex is in the cache while
+	// fewer than cacheSize misses happened after it was loaded, the same
+	// test as Tipsify's cache timestamps.
+	struct FifoVertexCache
+	{
+		vector<unsigned> loadedAt;
+		unsigned misses = 0;
+		// vertices loaded at or before this miss count as flushed
+		unsigned flushedAt = 0;
+		unsigned cacheSize;
+
+		FifoVertexCache(size_t vertexCount, int cacheSize) : loadedAt(vertexCount, 0), cacheSize((unsigned)cacheSize) {}
+
+		// Returns true when v missed and was loaded
+		bool Access(int v)
+		{
+			if (loadedAt[v] > flushedAt && misses - loadedAt[v] < cacheSize)
+				return false;
+			loadedAt[v] = ++misses;
+			return true;
+		}
+
+		void Flush() { flushedAt = misses; }
+	};
+
+	// Average cache miss ratio: simulated FIFO post-transform cache
+	// misses per triangle. 0.5 is ideal, 3.0 is every vertex missing.
+	inline float ComputeACMR(const vector<int>& indices, size_t vertexCount, int cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+	{
+		size_t triCount = indices.size() / 3;
+		if (triCount == 0)
+			return 0.0f;
+
+		FifoVertexCache cache(vertexCount, cacheSize);
+		for (size_t i = 0; i < triCount * 3; i++)
+			cache.Access(indices[i]);
+		return cache.misses / (float)triCount;
+	}
+
+	// Reorders triangles for post-transform vertex cache locality using
+	// Tipsify (Sander, Nehab, Barczak 2007). Runs in linear time, the
+	// vertex buffer itself is left untouched.
+	inline void OptimizeVertexCacheIndices(vector<int>& indices, size_t vertexCount, int cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+	{
+		const size_t triCount = indices.size() / 3;
+		if (triCount == 0 || vertexCount == 0)
+			return;
+
+		// vertex -> triangle adjacency in compressed rows
+		vector<int> live(vertexCount, 0);
+		for (size_t i = 0; i < triCount * 3; i++)
+			live[indices[i]]++;
+
+		vector<int> adjacencyStart(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyStart[v + 1] = adjacencyStart[v] + live[v];
+
+		vector<int> adjacency(adjacencyStart[vertexCount]);
+		{
+			vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+			for (size_t t = 0; t < triCount; t++)
+				for (int k = 0; k < 3; k++)
+					adjacency[fill[indices[t * 3 + k]]++] = (int)t;
+		}
+
+		vector<int> cacheTime(vertexCount, 0);
+		vector<bool> emitted(triCount, false);
+		vector<int> deadEnd;
+		vector<int> candidates;
+		vector<int> output;
+		output.reserve(triCount * 3);
+
+		int timeStamp = cacheSize + 1;
+		size_t cursor = 1;
+		int fanning = 0;
+
+		while (fanning >= 0)
+		{
+			candidates.clear();
+
+			// emit every remaining triangle around the fanning vertex
+			for (int a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; a++)
+			{
+				int t = adjacency[a];
+				if (emitted[t])
+					continue;
+
+				for (int k = 0; k < 3; k++)
+				{
+					int v = indices[t * 3 + k];
+					output.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					if (timeStamp - cacheTime[v] > cacheSize)
+						cacheTime[v] = timeStamp++;
+				}
+				emitted[t] = true;
+			}
+
+			// pick the candidate that stays in cache longest and still has work
+			int best = -1;
+			int bestPriority = -1;
+			for (int v : candidates)
+			{
+				if (live[v] <= 0)
+					continue;
+
+				int priority = 0;
+				if (timeStamp - cacheTime[v] + 2 * live[v] <= cacheSize)
+					priority = timeStamp - cacheTime[v];
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					best = v;
+				}
+			}
+
+			// dead end, back track through recently used vertices then scan forward
+			if (best == -1)
+			{
+				while (!deadEnd.empty())
+				{
+					int v = deadEnd.back();
+					deadEnd.pop_back();
+					if (live[v] > 0)
+					{
+						best = v;
+						break;
+					}
+				}
+			}
+			while (best == -1 && cursor < vertexCount)
+			{
+				if (live[cursor] > 0)
+					best = (int)cursor;
+				cursor++;
+			}
+
+			fanning = best;
+		}
+
+		// keep any trailing non-triangle indices as they were
+		output.insert(output.end(), indices.begin() + triCount * 3, indices.end());
+		indices = std::move(output);
+	}
+
+	template <typename T>
+	void OptimizeVertexCache(SimpleMesh<T>& simpleMesh, int cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+	{
+		const size_t vertexCount = simpleMesh.vertexList.size();
+
+		float acmrBefore = ComputeACMR(simpleMesh.indicesList, vertexCount, cacheSize);
+		OptimizeVertexCacheIndices(simpleMesh.indicesList, vertexCount, cacheSize);
+		float acmrAfter = ComputeACMR(simpleMesh.indicesList, vertexCount, cacheSize);
+
+		cout << "ACMR (cache size " << cacheSize << ") BEFORE: " << acmrBefore << " AFTER: " << acmrAfter << endl;
+	}
+
+	// Geometric (unnormalized, area weighted) normal of a triangle
+	template <typename T>
+	XMFLOAT3 TriangleNormal(const SimpleMesh<T>& simpleMesh, size_t tri)
+	{
+		const XMFLOAT3& a = simpleMesh.vertexList[simpleMesh.indicesList[tri * 3 + 0]].Pos;
+		const XMFLOAT3& b = simpleMesh.vertexList[simpleMesh.indicesList[tri * 3 + 1]].Pos;
+		const XMFLOAT3& c = simpleMesh.vertexList[simpleMesh.indicesList[tri * 3 + 2]].Pos;
+
+		float e1x = b.x - a.x, e1y = b.y - a.y, e1z = b.z - a.z;
+		float e2x = c.x - a.x, e2y = c.y - a.y, e2z = c.z - a.z;
+
+		return XMFLOAT3(e1y * e2z - e1z * e2y, e1z * e2x - e1x * e2z, e1x * e2y - e1y * e2x);
+	}
+
+	// CPU overdraw estimate: rasterizes the mesh in index order with early
+	// depth test and back face culling from the six axis directions and
+	// returns pixels shaded / pixels covered (1.0 means no overdraw)
+	template <typename T>
+	float EstimateOverdraw(const SimpleMesh<T>& simpleMesh, int resolution = 256)
+	{
+		const size_t triCount = simpleMesh.indicesList.size() / 3;
+		if (triCount == 0)
+			return 0.0f;
+
+		float minP[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float maxP[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const T& v : simpleMesh.vertexList)
+		{
+			const float p[3] = { v.Pos.x, v.Pos.y, v.Pos.z };
+			for (int k = 0; k < 3; k++)
+			{
+				minP[k] = std::min(minP[k], p[k]);
+				maxP[k] = std::max(maxP[k], p[k]);
+			}
+		}
+		float extent = std::max(maxP[0] - minP[0], std::max(maxP[1] - minP[1], maxP[2] - minP[2]));
+		if (extent <= 0.0f)
+			return 0.0f;
+		const float toGrid = (resolution - 1) / extent;
+
+		vector<float> depthBuffer((size_t)resolution * resolution);
+		unsigned long long pixelsShaded = 0;
+		unsigned long long pixelsCovered = 0;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const int u = (axis + 1) % 3;
+			const int w = (axis + 2) % 3;
+
+			for (float viewSign = -1.0f; viewSign <= 1.0f; viewSign += 2.0f)
+			{
+				std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+
+				for (size_t t = 0; t < triCount; t++)
+				{
+					// looking along viewSign * axis, skip faces pointing away
+					XMFLOAT3 n = TriangleNormal(simpleMesh, t);
+					const float nAxis = (&n.x)[axis];
+					if (nAxis * viewSign >= 0.0f)
+						continue;
+
+					float gx[3], gy[3], gz[3];
+					for (int k = 0; k < 3; k++)
+					{
+						const XMFLOAT3& p = simpleMesh.vertexList[simpleMesh.indicesList[t * 3 + k]].Pos;
+						gx[k] = ((&p.x)[u] - minP[u]) * toGrid;
+						gy[k] = ((&p.x)[w] - minP[w]) * toGrid;
+						gz[k] = ((&p.x)[axis] - minP[axis]) * viewSign;
+					}
+
+					float area = (gx[1] - gx[0]) * (gy[2] - gy[0]) - (gy[1] - gy[0]) * (gx[2] - gx[0]);
+					if (area == 0.0f)
+						continue;
+					const float invArea = 1.0f / area;
+
+					int x0 = std::max(0, (int)std::floor(std::min(gx[0], std::min(gx[1], gx[2]))));
+					int x1 = std::min(resolution - 1, (int)std::ceil(std::max(gx[0], std::max(gx[1], gx[2]))));
+					int y0 = std::max(0, (int)std::floor(std::min(gy[0], std::min(gy[1], gy[2]))));
+					int y1 = std::min(resolution - 1, (int)std::ceil(std::max(gy[0], std::max(gy[1], gy[2]))));
+
+					for (int y = y0; y <= y1; y++)
+					{
+						for (int x = x0; x <= x1; x++)
+						{
+							float px = x + 0.5f, py = y + 0.5f;
+							float b0 = ((gx[1] - px) * (gy[2] - py) - (gy[1] - py) * (gx[2] - px)) * invArea;
+							float b1 = ((gx[2] - px) * (gy[0] - py) - (gy[2] - py) * (gx[0] - px)) * invArea;
+							float b2 = 1.0f - b0 - b1;
+							if (b0 < 0.0f || b1 < 0.0f || b2 < 0.0f)
+								continue;
+
+							float depth = b0 * gz[0] + b1 * gz[1] + b2 * gz[2];
+							float& stored = depthBuffer[(size_t)y * resolution + x];
+							if (depth < stored)
+							{
+								if (stored == FLT_MAX)
+									pixelsCovered++;
+								pixelsShaded++;
+								stored = depth;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		return pixelsCovered ? pixelsShaded / (float)pixelsCovered : 0.0f;
+	}
+
+	// Reorders the triangles of a vertex cache optimized mesh to cut overdraw
+	// (Sander, Nehab, Barczak 2007). The index buffer is cut into clusters at
+	// cache flushes and wherever the running ACMR is within threshold of the
+	// cluster's ACMR, then clusters are sorted so the ones facing away from
+	// the mesh centre (likely occluders) draw first.
+	template <typename T>
+	void OptimizeOverdraw(SimpleMesh<T>& simpleMesh, float threshold = 1.05f, int cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+	{
+		vector<int>& indices = simpleMesh.indicesList;
+		const size_t vertexCount = simpleMesh.vertexList.size();
+		const size_t triCount = indices.size() / 3;
+		if (triCount == 0)
+			return;
+
+		float acmrBefore = ComputeACMR(indices, vertexCount, cacheSize);
+		float overdrawBefore = EstimateOverdraw(simpleMesh);
+
+		// simulate a FIFO cache, counting misses per triangle
+		vector<unsigned char> triMisses(triCount);
+		{
+			FifoVertexCache cache(vertexCount, cacheSize);
+			for (size_t t = 0; t < triCount; t++)
+			{
+				for (int k = 0; k < 3; k++)
+					triMisses[t] += cache.Access(indices[t * 3 + k]);
+			}
+		}
+
+		// hard boundaries where the cache is flushed (all three vertices miss)
+		vector<size_t> hardStarts;
+		for (size_t t = 0; t < triCount; t++)
+		{
+			if (t == 0 || triMisses[t] == 3)
+				hardStarts.push_back(t);
+		}
+		hardStarts.push_back(triCount);
+
+		// soft boundaries inside each hard cluster, cutting wherever the
+		// ACMR so far (from a cold cache) is already close to the ACMR of
+		// the whole cluster, so clusters can be drawn in any order
+		vector<size_t> clusterStarts;
+		{
+			// flushed at the start of every cluster
+			FifoVertexCache cache(vertexCount, cacheSize);
+
+			for (size_t h = 0; h + 1 < hardStarts.size(); h++)
+			{
+				size_t begin = hardStarts[h];
+				size_t end = hardStarts[h + 1];
+
+				unsigned clusterMisses = 0;
+				for (size_t t = begin; t < end; t++)
+					clusterMisses += triMisses[t];
+				float target = threshold * clusterMisses / (float)(end - begin);
+
+				clusterStarts.push_back(begin);
+				cache.Flush();
+				size_t runningStart = begin;
+				for (size_t t = begin; t < end; t++)
+				{
+					for (int k = 0; k < 3; k++)
+						cache.Access(indices[t * 3 + k]);
+
+					size_t runningCount = t - runningStart + 1;
+					if (t + 1 < end && (cache.misses - cache.flushedAt) / (float)runningCount <= target)
+					{
+						clusterStarts.push_back(t + 1);
+						runningStart = t + 1;
+						cache.Flush();
+					}
+				}
+			}
+			clusterStarts.push_back(triCount);
+		}
+
+		// mesh centroid, area weighted
+		float centroid[3] = { 0.0f, 0.0f, 0.0f };
+		float totalArea = 0.0f;
+		for (size_t t = 0; t < triCount; t++)
+		{
+			XMFLOAT3 n = TriangleNormal(simpleMesh, t);
+			float area = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+			for (int k = 0; k < 3; k++)
+			{
+				const XMFLOAT3& p = simpleMesh.vertexList[indices[t * 3 + k]].Pos;
+				centroid[0] += p.x * area / 3.0f;
+				centroid[1] += p.y * area / 3.0f;
+				centroid[2] += p.z * area / 3.0f;
+			}
+			totalArea += area;
+		}
+		if (totalArea > 0.0f)
+		{
+			for (int k = 0; k < 3; k++)
+				centroid[k] /= totalArea;
+		}
+
+		// sort key: how far the cluster faces outward from the mesh centroid
+		const size_t clusterCount = clusterStarts.size() - 1;
+		vector<float> clusterKeys(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			float center[3] = { 0.0f, 0.0f, 0.0f };
+			float normal[3] = { 0.0f, 0.0f, 0.0f };
+			float area = 0.0f;
+			for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+			{
+				XMFLOAT3 n = TriangleNormal(simpleMesh, t);
+				float triArea = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+				normal[0] += n.x;
+				normal[1] += n.y;
+				normal[2] += n.z;
+				for (int k = 0; k < 3; k++)
+				{
+					const XMFLOAT3& p = simpleMesh.vertexList[indices[t * 3 + k]].Pos;
+					center[0] += p.x * triArea / 3.0f;
+					center[1] += p.y * triArea / 3.0f;
+					center[2] += p.z * triArea / 3.0f;
+				}
+				area += triArea;
+			}
+			if (area > 0.0f)
+			{
+				for (int k = 0; k < 3; k++)
+					center[k] /= area;
+			}
+			float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (normalLength > 0.0f)
+			{
+				for (int k = 0; k < 3; k++)
+					normal[k] /= normalLength;
+			}
+			clusterKeys[c] =
+				(center[0] - centroid[0]) * normal[0] +
+				(center[1] - centroid[1]) * normal[1] +
+				(center[2] - centroid[2]) * normal[2];
+		}
+
+		vector<size_t> clusterOrder(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+			clusterOrder[c] = c;
+		std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+			[&](size_t a, size_t b) { return clusterKeys[a] > clusterKeys[b]; });
+
+		vector<int> sortedIndices;
+		sortedIndices.reserve(indices.size());
+		for (size_t c : clusterOrder)
+			sortedIndices.insert(sortedIndices.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+		sortedIndices.insert(sortedIndices.end(), indices.begin() + triCount * 3, indices.end());
+		indices = std::move(sortedIndices);
+
+		float acmrAfter = ComputeACMR(indices, vertexCount, cacheSize);
+		float overdrawAfter = EstimateOverdraw(simpleMesh);
+
+		cout << "Overdraw clusters: " << clusterCount << endl;
+		cout << "Overdraw BEFORE: " << overdrawBefore << " AFTER: " << overdrawAfter << endl;
+		cout << "ACMR after overdraw sort BEFORE: " << acmrBefore << " AFTER: " << acmrAfter << endl;
+	}
+
+	// Renumbers the vertices in the order the index buffer first uses them
+	// so vertex fetch walks the vertex buffer mostly linearly. Run after
+	// OptimizeVertexCache. Vertices no triangle uses are dropped.
+	template <typename T>
+	void OptimizeVertexFetch(SimpleMesh<T>& simpleMesh)
+	{
+		const size_t vertexCount = simpleMesh.vertexList.size();
+
+		vector<int> remap(vertexCount, -1);
+		vector<T> fetchOrderedList;
+		fetchOrderedList.reserve(vertexCount);
+
+		for (int& index : simpleMesh.indicesList)
+		{
+			if (remap[index] == -1)
+			{
+				remap[index] = (int)fetchOrderedList.size();
+				fetchOrderedList.push_back(simpleMesh.vertexList[index]);
+			}
+			index = remap[index];
+		}
+
+		if (fetchOrderedList.size() != vertexCount)
+			cout << "Vertex fetch reorder dropped " << (vertexCount - fetchOrderedList.size()) << " unused vertices" << endl;
+
+		simpleMesh.vertexList = std::move(fetchOrderedList);
+	}
+
+	// Switches the mesh to 16 bit indices when every vertex can be addressed
+	// with them, halving index memory. Run as the last loader step since the
+	// other MeshUtils passes work on indicesList.
+	template <typename T>
+	bool CompactIndices(SimpleMesh<T>& simpleMesh)
+	{
+		if (simpleMesh.vertexList.size() > 65536)
+			return false;
+
+		simpleMesh.indicesList16.assign(simpleMesh.indicesList.begin(), simpleMesh.indicesList.end());
+		vector<int>().swap(simpleMesh.indicesList);
+		return true;
+	}
+
+	// Octahedral normal encoding, snorm16 results in out[0], out[1]
+	inline void EncodeOctahedral(const XMFLOAT3& n, int16_t out[2])
+	{
+		// multiply by the reciprocal so results match EncodeOctahedral4 exactly
+		float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		float invL1 = l1 > 0.0f ? 1.0f / l1 : 0.0f;
+		float x = n.x * invL1;
+		float y = n.y * invL1;
+		if (n.z < 0.0f)
+		{
+			float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = fx;
+			y = fy;
+		}
+		out[0] = (int16_t)lrintf(std::max(-1.0f, std::min(1.0f, x)) * 32767.0f);
+		out[1] = (int16_t)lrintf(std::max(-1.0f, std::min(1.0f, y)) * 32767.0f);
+	}
+
+	inline uint16_t QuantizeUnorm16(float value, float minValue, float invExtent)
+	{
+		float q = (value - minValue) * invExtent;
+		return (uint16_t)lrintf(std::max(0.0f, std::min(1.0f, q)) * 65535.0f);
+	}
+
+	inline PackedVertexBounds ComputePackedVertexBounds(const vector<SimpleVertex>& vertices)
+	{
+		PackedVertexBounds bounds;
+		if (vertices.empty())
+			return bounds;
+
+		XMFLOAT3 pMin = vertices[0].Pos, pMax = vertices[0].Pos;
+		XMFLOAT2 tMin = vertices[0].Tex, tMax = vertices[0].Tex;
+		for (const SimpleVertex& v : vertices)
+		{
+			pMin.x = std::min(pMin.x, v.Pos.x); pMax.x = std::max(pMax.x, v.Pos.x);
+			pMin.y = std::min(pMin.y, v.Pos.y); pMax.y = std::max(pMax.y, v.Pos.y);
+			pMin.z = std::min(pMin.z, v.Pos.z); pMax.z = std::max(pMax.z, v.Pos.z);
+			tMin.x = std::min(tMin.x, v.Tex.x); tMax.x = std::max(tMax.x, v.Tex.x);
+			tMin.y = std::min(tMin.y, v.Tex.y); tMax.y = std::max(tMax.y, v.Tex.y);
+		}
+
+		// keep a non zero extent so flat meshes still decode
+		bounds.posMin = { pMin.x, pMin.y, pMin.z, 0.0f };
+		bounds.posExtent = { std::max(pMax.x - pMin.x, FLT_MIN), std::max(pMax.y - pMin.y, FLT_MIN), std::max(pMax.z - pMin.z, FLT_MIN), 0.0f };
+		bounds.texMin = { tMin.x, tMin.y, 0.0f, 0.0f };
+		bounds.texExtent = { std::max(tMax.x - tMin.x, FLT_MIN), std::max(tMax.y - tMin.y, FLT_MIN), 0.0f, 0.0f };
+		return bounds;
+	}
+
+	// SSE2 helpers for the 4-wide encode kernels
+
+	// octahedral encode of 4 normals given as x, y, z lanes, returns the
+	// snorm16 results as 32 bit ints (rounded to nearest)
+	inline void EncodeOctahedral4(__m128 x, __m128 y, __m128 z, __m128i& outX, __m128i& outY)
+	{
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 zero = _mm_setzero_ps();
+
+		__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, x), _mm_andnot_ps(signMask, y)), _mm_andnot_ps(signMask, z));
+		__m128 valid = _mm_cmpgt_ps(l1, zero);
+		__m128 invL1 = _mm_and_ps(valid, _mm_div_ps(one, _mm_or_ps(l1, _mm_andnot_ps(valid, one))));
+		x = _mm_mul_ps(x, invL1);
+		y = _mm_mul_ps(y, invL1);
+
+		// fold the lower hemisphere over the diagonals, sign(0) counts as +1
+		__m128 signX = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(x, zero), signMask), one);
+		__m128 signY = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(y, zero), signMask), one);
+		__m128 foldX = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, y)), signX);
+		__m128 foldY = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, x)), signY);
+		__m128 lower = _mm_cmplt_ps(z, zero);
+		x = _mm_or_ps(_mm_and_ps(lower, foldX), _mm_andnot_ps(lower, x));
+		y = _mm_or_ps(_mm_and_ps(lower, foldY), _mm_andnot_ps(lower, y));
+
+		const __m128 scale = _mm_set1_ps(32767.0f);
+		const __m128 minusOne = _mm_set1_ps(-1.0f);
+		outX = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(x, minusOne), one), scale));
+		outY = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(y, minusOne), one), scale));
+	}
+
+	// unorm16 quantize of 4 values as 32 bit ints (rounded to nearest)
+	inline __m128i QuantizeUnorm16x4(__m128 value, __m128 minValue, __m128 invExtent)
+	{
+		__m128 q = _mm_mul_ps(_mm_sub_ps(value, minValue), invExtent);
+		q = _mm_min_ps(_mm_max_ps(q, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+		return _mm_cvtps_epi32(_mm_mul_ps(q, _mm_set1_ps(65535.0f)));
+	}
+
+	// Encodes a SimpleVertex mesh into 16 byte vertices, 4 vertices per
+	// SSE2 iteration. bounds receives the constants Packed_VS needs.
+	inline void EncodePackedVertices(const SimpleMesh<SimpleVertex>& simpleMesh, SimpleMesh<PackedVertex16>& packedMesh, PackedVertexBounds& bounds)
+	{
+		const vector<SimpleVertex>& in = simpleMesh.vertexList;
+		const size_t count = in.size();
+		bounds = ComputePackedVertexBounds(in);
+
+		vector<PackedVertex16>& out = packedMesh.vertexList;
+		out.resize(count);
+
+		const float invPos[3] = { 1.0f / bounds.posExtent.x, 1.0f / bounds.posExtent.y, 1.0f / bounds.posExtent.z };
+		const float invTex[2] = { 1.0f / bounds.texExtent.x, 1.0f / bounds.texExtent.y };
+
+		const __m128 pMinX = _mm_set1_ps(bounds.posMin.x), pMinY = _mm_set1_ps(bounds.posMin.y), pMinZ = _mm_set1_ps(bounds.posMin.z);
+		const __m128 pInvX = _mm_set1_ps(invPos[0]), pInvY = _mm_set1_ps(invPos[1]), pInvZ = _mm_set1_ps(invPos[2]);
+		const __m128 tMinU = _mm_set1_ps(bounds.texMin.x), tMinV = _mm_set1_ps(bounds.texMin.y);
+		const __m128 tInvU = _mm_set1_ps(invTex[0]), tInvV = _mm_set1_ps(invTex[1]);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			const SimpleVertex* v = in.data() + i;
+
+			// transpose 4 vertices to SoA lanes
+			__m128 px = _mm_setr_ps(v[0].Pos.x, v[1].Pos.x, v[2].Pos.x, v[3].Pos.x);
+			__m128 py = _mm_setr_ps(v[0].Pos.y, v[1].Pos.y, v[2].Pos.y, v[3].Pos.y);
+			__m128 pz = _mm_setr_ps(v[0].Pos.z, v[1].Pos.z, v[2].Pos.z, v[3].Pos.z);
+			__m128 nx = _mm_setr_ps(v[0].Normal.x, v[1].Normal.x, v[2].Normal.x, v[3].Normal.x);
+			__m128 ny = _mm_setr_ps(v[0].Normal.y, v[1].Normal.y, v[2].Normal.y, v[3].Normal.y);
+			__m128 nz = _mm_setr_ps(v[0].Normal.z, v[1].Normal.z, v[2].Normal.z, v[3].Normal.z);
+			__m128 tu = _mm_setr_ps(v[0].Tex.x, v[1].Tex.x, v[2].Tex.x, v[3].Tex.x);
+			__m128 tv = _mm_setr_ps(v[0].Tex.y, v[1].Tex.y, v[2].Tex.y, v[3].Tex.y);
+
+			alignas(16) int32_t qx[4], qy[4], qz[4], ox[4], oy[4], qu[4], qv[4];
+			_mm_store_si128((__m128i*)qx, QuantizeUnorm16x4(px, pMinX, pInvX));
+			_mm_store_si128((__m128i*)qy, QuantizeUnorm16x4(py, pMinY, pInvY));
+			_mm_store_si128((__m128i*)qz, QuantizeUnorm16x4(pz, pMinZ, pInvZ));
+			_mm_store_si128((__m128i*)qu, QuantizeUnorm16x4(tu, tMinU, tInvU));
+			_mm_store_si128((__m128i*)qv, QuantizeUnorm16x4(tv, tMinV, tInvV));
+
+			__m128i octX, octY;
+			EncodeOctahedral4(nx, ny, nz, octX, octY);
+			_mm_store_si128((__m128i*)ox, octX);
+			_mm_store_si128((__m128i*)oy, octY);
+
+			for (int k = 0; k < 4; k++)
+			{
+				PackedVertex16& p = out[i + k];
+				p.Pos[0] = (uint16_t)qx[k];
+				p.Pos[1] = (uint16_t)qy[k];
+				p.Pos[2] = (uint16_t)qz[k];
+				p.Pos[3] = 0;
+				p.Normal[0] = (int16_t)ox[k];
+				p.Normal[1] = (int16_t)oy[k];
+				p.Tex[0] = (uint16_t)qu[k];
+				p.Tex[1] = (uint16_t)qv[k];
+			}
+		}
+
+		// scalar tail
+		for (; i < count; i++)
+		{
+			const SimpleVertex& v = in[i];
+			PackedVertex16& p = out[i];
+			p.Pos[0] = QuantizeUnorm16(v.Pos.x, bounds.posMin.x, invPos[0]);
+			p.Pos[1] = QuantizeUnorm16(v.Pos.y, bounds.posMin.y, invPos[1]);
+			p.Pos[2] = QuantizeUnorm16(v.Pos.z, bounds.posMin.z, invPos[2]);
+			p.Pos[3] = 0;
+			EncodeOctahedral(v.Normal, p.Normal);
+			p.Tex[0] = QuantizeUnorm16(v.Tex.x, bounds.texMin.x, invTex[0]);
+			p.Tex[1] = QuantizeUnorm16(v.Tex.y, bounds.texMin.y, invTex[1]);
+		}
+
+		packedMesh.indicesList = simpleMesh.indicesList;
+		packedMesh.indicesList16 = simpleMesh.indicesList16;
+	}
+
+	// Encodes a SimpleVertex mesh into 24 byte vertices (octahedral normal only),
+	// 4 vertices per SSE2 iteration. bounds is the identity decode for Packed_VS.
+	inline void EncodePackedVertices(const SimpleMesh<SimpleVertex>& simpleMesh, SimpleMesh<PackedVertex24>& packedMesh, PackedVertexBounds& bounds)
+	{
+		const vector<SimpleVertex>& in = simpleMesh.vertexList;
+		const size_t count = in.size();
+		bounds = PackedVertexBounds();
+
+		vector<PackedVertex24>& out = packedMesh.vertexList;
+		out.resize(count);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			const SimpleVertex* v = in.data() + i;
+
+			__m128 nx = _mm_setr_ps(v[0].Normal.x, v[1].Normal.x, v[2].Normal.x, v[3].Normal.x);
+			__m128 ny = _mm_setr_ps(v[0].Normal.y, v[1].Normal.y, v[2].Normal.y, v[3].Normal.y);
+			__m128 nz = _mm_setr_ps(v[0].Normal.z, v[1].Normal.z, v[2].Normal.z, v[3].Normal.z);
+
+			alignas(16) int32_t ox[4], oy[4];
+			__m128i octX, octY;
+			EncodeOctahedral4(nx, ny, nz, octX, octY);
+			_mm_store_si128((__m128i*)ox, octX);
+			_mm_store_si128((__m128i*)oy, octY);
+
+			for (int k = 0; k < 4; k++)
+			{
+				PackedVertex24& p = out[i + k];
+				p.Pos = v[k].Pos;
+				p.Normal[0] = (int16_t)ox[k];
+				p.Normal[1] = (int16_t)oy[k];
+				p.Tex = v[k].Tex;
+			}
+		}
+
+		// scalar tail
+		for (; i < count; i++)
+		{
+			PackedVertex24& p = out[i];
+			p.Pos = in[i].Pos;
+			EncodeOctahedral(in[i].Normal, p.Normal);
+			p.Tex = in[i].Tex;
+		}
+
+		packedMesh.indicesList = simpleMesh.indicesList;
+		packedMesh.indicesList16 = simpleMesh.indicesList16;
+	}
+
+	// Quantizes 4 weights to unorm8 so they sum to exactly 255 (1.0 after
+	// decode). Weights are normalized first, then the rounding remainder
+	// goes to the weights with the largest fractional parts.
+	inline void QuantizeSkinWeights(const XMFLOAT4& weights, uint8_t out[4])
+	{
+		float w[4] = { std::max(weights.x, 0.0f), std::max(weights.y, 0.0f), std::max(weights.z, 0.0f), std::max(weights.w, 0.0f) };
+		float total = w[0] + w[1] + w[2] + w[3];
+		if (total <= 0.0f)
+		{
+			out[0] = 255;
+			out[1] = out[2] = out[3] = 0;
+			return;
+		}
+
+		float fraction[4];
+		int sum = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			float scaled = w[k] / total * 255.0f;
+			int q = std::min(255, (int)scaled);
+			out[k] = (uint8_t)q;
+			fraction[k] = scaled - q;
+			sum += q;
+		}
+
+		for (int remainder = 255 - sum; remainder > 0; remainder--)
+		{
+			int best = 0;
+			for (int k = 1; k < 4; k++)
+			{
+				if (fraction[k] > fraction[best])
+					best = k;
+			}
+			out[best]++;
+			fraction[best] = -1.0f;
+		}
+	}
+
+	// Converts a skinned mesh to 8 bit joint indices and unorm8 weights.
+	// Returns false when a weighted influence references a joint past 255,
+	// split the mesh into joint palettes first for larger skeletons.
+	inline bool CompressSkinning(const SimpleMesh<SkinnedVertex>& skinnedMesh, SimpleMesh<SkinnedVertexCompact>& compactMesh)
+	{
+		compactMesh.vertexList.resize(skinnedMesh.vertexList.size());
+		for (size_t i = 0; i < skinnedMesh.vertexList.size(); i++)
+		{
+			const SkinnedVertex& v = skinnedMesh.vertexList[i];
+			SkinnedVertexCompact& c = compactMesh.vertexList[i];
+			c.Pos = v.Pos;
+			c.Normal = v.Normal;
+			c.Tex = v.Tex;
+
+			QuantizeSkinWeights(v.weights, c.weights);
+
+			const int32_t indices[4] = { v.indices.x, v.indices.y, v.indices.z, v.indices.w };
+			for (int k = 0; k < 4; k++)
+			{
+				// an unused influence may point at any joint, keep it in range
+				if (!c.weights[k])
+				{
+					c.indices[k] = 0;
+					continue;
+				}
+				if (indices[k] < 0 || indices[k] > 0xff)
+				{
+					compactMesh = SimpleMesh<SkinnedVertexCompact>();
+					return false;
+				}
+				c.indices[k] = (uint8_t)indices[k];
+			}
+		}
+		compactMesh.indicesList = skinnedMesh.indicesList;
+		compactMesh.indicesList16 = skinnedMesh.indicesList16;
+		return true;
+	}
+
+	// Index of a mesh that may have been switched to 16 bit indices
+	template <typename T>
+	inline int GetIndex(const SimpleMesh<T>& simpleMesh, size_t i)
+	{
+		return simpleMesh.indicesList16.empty() ? simpleMesh.indicesList[i] : (int)simpleMesh.indicesList16[i];
+	}
+
+	template <typename T>
+	inline size_t GetIndexCount(const SimpleMesh<T>& simpleMesh)
+	{
+		return simpleMesh.indicesList16.empty() ? simpleMesh.indicesList.size() : simpleMesh.indicesList16.size();
+	}
+
+	// Appends part to the shared mesh as a new submesh, the indices stay
+	// local to the part and are offset by baseVertex at draw time
+	template <typename T>
+	void AppendSubMesh(SimpleMesh<T>& sharedMesh, vector<SubMesh>& subMeshes, const SimpleMesh<T>& part, uint32_t materialSlot)
+	{
+		assert(sharedMesh.indicesList16.empty());
+
+		SubMesh subMesh;
+		subMesh.indexStart = (uint32_t)sharedMesh.indicesList.size();
+		subMesh.indexCount = (uint32_t)GetIndexCount(part);
+		subMesh.baseVertex = (int32_t)sharedMesh.vertexList.size();
+		subMesh.materialSlot = materialSlot;
+		subMeshes.push_back(subMesh);
+
+		sharedMesh.vertexList.insert(sharedMesh.vertexList.end(), part.vertexList.begin(), part.vertexList.end());
+		for (size_t i = 0; i < subMesh.indexCount; i++)
+			sharedMesh.indicesList.push_back(GetIndex(part, i));
+	}
+
+	// CompactIndices for a mesh built with AppendSubMesh, 16 bit indices are
+	// used when every submesh can address its own vertices with them
+	template <typename T>
+	bool CompactSubMeshIndices(SimpleMesh<T>& sharedMesh)
+	{
+		for (int index : sharedMesh.indicesList)
+			if (index > 65535)
+				return false;
+
+		sharedMesh.indicesList16.assign(sharedMesh.indicesList.begin(), sharedMesh.indicesList.end());
+		vector<int>().swap(sharedMesh.indicesList);
+		return true;
+	}
+
+	// Joints with a non zero weight on one vertex
+	inline int GetSkinJoints(const SkinnedVertex& v, int joints[4])
+	{
+		const float weights[4] = { v.weights.x, v.weights.y, v.weights.z, v.weights.w };
+		const int32_t indices[4] = { v.indices.x, v.indices.y, v.indices.z, v.indices.w };
+		int count = 0;
+		for (int k = 0; k < 4; k++)
+			if (weights[k] > 0.0f)
+				joints[count++] = indices[k];
+		return count;
+	}
+
+	// Assigns every triangle of a skinned mesh to a partition referencing at
+	// most maxJoints joints, aiming for as few partitions as possible.
+	// Triangles with the same joint set form one group. A partition is
+	// seeded with the largest unassigned group and then takes the group
+	// adding the fewest joints it does not have yet (most shared joints on
+	// ties) until nothing fits. Partitions whose joints fit together are
+	// merged afterwards. Returns the partition count.
+	inline uint32_t PartitionByJointPalette(const SimpleMesh<SkinnedVertex>& skinnedMesh, int jointCount,
+		vector<uint32_t>& triPartition, int maxJoints = MAX_PALETTE_JOINTS)
+	{
+		// a single triangle can reference 12 joints
+		assert(maxJoints >= 12);
+
+		const vector<int>& indices = skinnedMesh.indicesList;
+		const size_t triCount = indices.size() / 3;
+		triPartition.assign(triCount, 0);
+
+		// sorted joint set of every triangle
+		struct TriJoints
+		{
+			int joints[12];
+			int count = 0;
+		};
+		vector<TriJoints> triJoints(triCount);
+		for (size_t t = 0; t < triCount; t++)
+		{
+			TriJoints& tj = triJoints[t];
+			for (int c = 0; c < 3; c++)
+				tj.count += GetSkinJoints(skinnedMesh.vertexList[indices[t * 3 + c]], tj.joints + tj.count);
+			std::sort(tj.joints, tj.joints + tj.count);
+			tj.count = (int)(std::unique(tj.joints, tj.joints + tj.count) - tj.joints);
+		}
+
+		// group the triangles by joint set
+		vector<uint32_t> order(triCount);
+		for (size_t t = 0; t < triCount; t++)
+			order[t] = (uint32_t)t;
+		auto sameJoints = [&](uint32_t a, uint32_t b)
+		{
+			const TriJoints& ja = triJoints[a];
+			const TriJoints& jb = triJoints[b];
+			return ja.count == jb.count && std::equal(ja.joints, ja.joints + ja.count, jb.joints);
+		};
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+		{
+			const TriJoints& ja = triJoints[a];
+			const TriJoints& jb = triJoints[b];
+			return std::lexicographical_compare(ja.joints, ja.joints + ja.count, jb.joints, jb.joints + jb.count);
+		});
+
+		struct Group
+		{
+			uint32_t orderStart = 0;
+			uint32_t triCount = 0;
+			int jointCount = 0;
+			const int* joints = nullptr;
+		};
+		vector<Group> groups;
+		for (size_t i = 0; i < triCount; i++)
+		{
+			if (i == 0 || !sameJoints(order[i - 1], order[i]))
+			{
+				const TriJoints& tj = triJoints[order[i]];
+				groups.push_back({ (uint32_t)i, 0, tj.count, tj.joints });
+			}
+			groups.back().triCount++;
+		}
+
+		// groups referencing each joint
+		vector<vector<uint32_t>> jointGroups(jointCount);
+		for (uint32_t g = 0; g < groups.size(); g++)
+			for (int i = 0; i < groups[g].jointCount; i++)
+				jointGroups[groups[g].joints[i]].push_back(g);
+
+		const uint32_t none = UINT32_MAX;
+		vector<uint32_t> groupPartition(groups.size(), none);
+		vector<vector<int>> partitionJoints;
+		// joints of a group missing from the partition being filled
+		vector<int> missing(groups.size());
+		vector<uint32_t> jointPartition(jointCount, none);
+
+		// unassigned groups bucketed by joints missing from the partition
+		// being filled and by joint count, stale entries are skipped on pop
+		const int maxGroupJoints = 12;
+		vector<uint32_t> buckets[maxGroupJoints + 1][maxGroupJoints + 1];
+		auto popCheapest = [&](int room) -> uint32_t
+		{
+			for (int m = 0; m <= std::min(room, maxGroupJoints); m++)
+			{
+				for (int count = maxGroupJoints; count >= m; count--)
+				{
+					vector<uint32_t>& bucket = buckets[m][count];
+					while (!bucket.empty())
+					{
+						uint32_t g = bucket.back();
+						bucket.pop_back();
+						if (groupPartition[g] == none && missing[g] == m)
+							return g;
+					}
+				}
+			}
+			return none;
+		};
+
+		size_t remaining = groups.size();
+		while (remaining > 0)
+		{
+			uint32_t p = (uint32_t)partitionJoints.size();
+			partitionJoints.emplace_back();
+			vector<int>& joints = partitionJoints.back();
+
+			// seed with the largest group, the most triangles on ties
+			uint32_t next = none;
+			for (auto& row : buckets)
+				for (vector<uint32_t>& bucket : row)
+					bucket.clear();
+			for (uint32_t g = 0; g < groups.size(); g++)
+			{
+				if (groupPartition[g] != none)
+					continue;
+				missing[g] = groups[g].jointCount;
+				buckets[missing[g]][groups[g].jointCount].push_back(g);
+				if (next == none || groups[g].jointCount > groups[next].jointCount ||
+					(groups[g].jointCount == groups[next].jointCount && groups[g].triCount > groups[next].triCount))
+					next = g;
+			}
+
+			while (next != none)
+			{
+				const Group& group = groups[next];
+				groupPartition[next] = p;
+				remaining--;
+				for (int i = 0; i < group.jointCount; i++)
+				{
+					int joint = group.joints[i];
+					if (jointPartition[joint] == p)
+						continue;
+					jointPartition[joint] = p;
+					joints.push_back(joint);
+					for (uint32_t g : jointGroups[joint])
+					{
+						if (groupPartition[g] != none)
+							continue;
+						missing[g]--;
+						buckets[missing[g]][groups[g].jointCount].push_back(g);
+					}
+				}
+
+				// cheapest group that still fits, the most shared joints on ties
+				next = popCheapest(maxJoints - (int)joints.size());
+			}
+		}
+
+		// merge partitions whose joints fit one palette
+		const uint32_t partitionCount = (uint32_t)partitionJoints.size();
+		vector<uint32_t> mergedInto(partitionCount);
+		for (uint32_t p = 0; p < partitionCount; p++)
+			mergedInto[p] = p;
+		for (uint32_t a = 0; a < partitionCount; a++)
+		{
+			if (mergedInto[a] != a)
+				continue;
+			for (uint32_t b = a + 1; b < partitionCount; b++)
+			{
+				if (mergedInto[b] != b)
+					continue;
+				vector<int> ja = partitionJoints[a];
+				vector<int> jb = partitionJoints[b];
+				std::sort(ja.begin(), ja.end());
+				std::sort(jb.begin(), jb.end());
+				vector<int> merged;
+				std::set_union(ja.begin(), ja.end(), jb.begin(), jb.end(), std::back_inserter(merged));
+				if ((int)merged.size() > maxJoints)
+					continue;
+				partitionJoints[a] = std::move(merged);
+				partitionJoints[b].clear();
+				mergedInto[b] = a;
+			}
+		}
+
+		// number the surviving partitions in order
+		vector<uint32_t> finalIndex(partitionCount, none);
+		uint32_t finalCount = 0;
+		for (uint32_t p = 0; p < partitionCount; p++)
+			if (mergedInto[p] == p)
+				finalIndex[p] = finalCount++;
+
+		for (uint32_t g = 0; g < groups.size(); g++)
+		{
+			uint32_t p = finalIndex[mergedInto[groupPartition[g]]];
+			for (uint32_t i = 0; i < groups[g].triCount; i++)
+				triPartition[order[groups[g].orderStart + i]] = p;
+		}
+		return finalCount;
+	}
+
+	// Splits a skinned mesh into submeshes that each reference at most
+	// maxJoints joints, using PartitionByJointPalette. Triangles keep their
+	// (cache optimized) order within a submesh, vertices used by several
+	// submeshes are duplicated and joint indices are rewritten to palette
+	// entries, the palette of each submesh is in skeleton order. A mesh
+	// whose skeleton fits stays one submesh with the identity palette of
+	// jointCount joints.
+	inline void SplitByJointPalette(SimpleMesh<SkinnedVertex>& skinnedMesh, int jointCount, JointPalettes& palettes, int maxJoints = MAX_PALETTE_JOINTS)
+	{
+		assert(skinnedMesh.indicesList16.empty());
+		palettes = JointPalettes();
+
+		const vector<int>& indices = skinnedMesh.indicesList;
+		const size_t triCount = indices.size() / 3;
+
+		if (jointCount <= maxJoints)
+		{
+			SubMesh subMesh;
+			subMesh.indexCount = (uint32_t)indices.size();
+			subMesh.paletteCount = (uint32_t)jointCount;
+			palettes.subMeshes.push_back(subMesh);
+			for (int j = 0; j < jointCount; j++)
+				palettes.joints.push_back(j);
+			return;
+		}
+
+		vector<uint32_t> triPartition;
+		uint32_t partitionCount = PartitionByJointPalette(skinnedMesh, jointCount, triPartition, maxJoints);
+
+		// triangles of each partition in index order
+		vector<uint32_t> partitionStart(partitionCount + 1, 0);
+		for (uint32_t p : triPartition)
+			partitionStart[p + 1]++;
+		for (uint32_t p = 0; p < partitionCount; p++)
+			partitionStart[p + 1] += partitionStart[p];
+		vector<uint32_t> partitionTris(triCount);
+		{
+			vector<uint32_t> cursor(partitionStart.begin(), partitionStart.end() - 1);
+			for (size_t t = 0; t < triCount; t++)
+				partitionTris[cursor[triPartition[t]]++] = (uint32_t)t;
+		}
+
+		SimpleMesh<SkinnedVertex> splitMesh;
+		// palette entry of each joint and local index of each vertex in the
+		// submesh being built, -1 when not in it
+		vector<int> paletteEntry(jointCount, -1);
+		vector<int> localIndex(skinnedMesh.vertexList.size(), -1);
+
+		for (uint32_t p = 0; p < partitionCount; p++)
+		{
+			SubMesh subMesh;
+			subMesh.indexStart = (uint32_t)splitMesh.indicesList.size();
+			subMesh.baseVertex = (int32_t)splitMesh.vertexList.size();
+			subMesh.paletteStart = (uint32_t)palettes.joints.size();
+
+			for (uint32_t i = partitionStart[p]; i < partitionStart[p + 1]; i++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					int joints[4];
+					int count = GetSkinJoints(skinnedMesh.vertexList[indices[partitionTris[i] * 3 + c]], joints);
+					for (int k = 0; k < count; k++)
+					{
+						if (paletteEntry[joints[k]] < 0)
+						{
+							paletteEntry[joints[k]] = 0;
+							palettes.joints.push_back(joints[k]);
+						}
+					}
+				}
+			}
+			std::sort(palettes.joints.begin() + subMesh.paletteStart, palettes.joints.end());
+			for (size_t i = subMesh.paletteStart; i < palettes.joints.size(); i++)
+				paletteEntry[palettes.joints[i]] = (int)(i - subMesh.paletteStart);
+
+			for (uint32_t i = partitionStart[p]; i < partitionStart[p + 1]; i++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					int index = indices[partitionTris[i] * 3 + c];
+					if (localIndex[index] < 0)
+					{
+						SkinnedVertex v = skinnedMesh.vertexList[index];
+						int32_t* joints[4] = { &v.indices.x, &v.indices.y, &v.indices.z, &v.indices.w };
+						const float weights[4] = { v.weights.x, v.weights.y, v.weights.z, v.weights.w };
+						for (int k = 0; k < 4; k++)
+							*joints[k] = weights[k] > 0.0f ? paletteEntry[*joints[k]] : 0;
+
+						localIndex[index] = (int)(splitMesh.vertexList.size() - subMesh.baseVertex);
+						splitMesh.vertexList.push_back(v);
+					}
+					splitMesh.indicesList.push_back(localIndex[index]);
+				}
+			}
+
+			subMesh.indexCount = (uint32_t)(splitMesh.indicesList.size() - subMesh.indexStart);
+			subMesh.paletteCount = (uint32_t)(palettes.joints.size() - subMesh.paletteStart);
+			palettes.subMeshes.push_back(subMesh);
+
+			for (size_t i = subMesh.paletteStart; i < palettes.joints.size(); i++)
+				paletteEntry[palettes.joints[i]] = -1;
+			for (uint32_t i = partitionStart[p]; i < partitionStart[p + 1]; i++)
+				for (int c = 0; c < 3; c++)
+					localIndex[indices[partitionTris[i] * 3 + c]] = -1;
+		}
+
+		skinnedMesh = std::move(splitMesh);
+	}
+
+	const uint32_t DEFAULT_CLUSTER_MAX_VERTICES = 64;
+	const uint32_t DEFAULT_CLUSTER_MAX_TRIANGLES = 124;
+
+	// Splits the index buffer, in its current (cache optimized) order, into
+	// contiguous clusters of at most maxVertices unique vertices and
+	// maxTriangles triangles, each with a bounding sphere and normal cone.
+	// Run after the final vertex transform (rh_to_lh_coord).
+	template <typename T>
+	void BuildMeshClusters(const SimpleMesh<T>& simpleMesh, vector<MeshCluster>& clusters,
+		uint32_t maxVertices = DEFAULT_CLUSTER_MAX_VERTICES, uint32_t maxTriangles = DEFAULT_CLUSTER_MAX_TRIANGLES)
+	{
+		clusters.clear();
+
+		const size_t triCount = GetIndexCount(simpleMesh) / 3;
+		vector<uint32_t> lastCluster(simpleMesh.vertexList.size(), UINT32_MAX);
+
+		auto position = [&](size_t i) -> const XMFLOAT3& { return simpleMesh.vertexList[GetIndex(simpleMesh, i)].Pos; };
+
+		MeshCluster cluster;
+		size_t t = 0;
+		while (t < triCount)
+		{
+			// grow the cluster until a limit would be exceeded
+			uint32_t clusterId = (uint32_t)clusters.size();
+			cluster = MeshCluster();
+			cluster.indexStart = (uint32_t)(t * 3);
+
+			for (; t < triCount && cluster.indexCount / 3 < maxTriangles; t++)
+			{
+				uint32_t newVertices = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					int v = GetIndex(simpleMesh, t * 3 + k);
+					newVertices += (lastCluster[v] != clusterId);
+				}
+				if (cluster.vertexCount + newVertices > maxVertices)
+					break;
+
+				for (int k = 0; k < 3; k++)
+				{
+					int v = GetIndex(simpleMesh, t * 3 + k);
+					if (lastCluster[v] != clusterId)
+					{
+						lastCluster[v] = clusterId;
+						cluster.vertexCount++;
+					}
+				}
+				cluster.indexCount += 3;
+			}
+
+			const size_t begin = cluster.indexStart;
+			const size_t end = cluster.indexStart + cluster.indexCount;
+
+			// bounding sphere (Ritter), seeded with the two furthest apart points from the first one
+			XMFLOAT3 a = position(begin);
+			XMFLOAT3 b = a;
+			float best = -1.0f;
+			for (size_t i = begin; i < end; i++)
+			{
+				const XMFLOAT3& p = position(i);
+				float d = (p.x - a.x) * (p.x - a.x) + (p.y - a.y) * (p.y - a.y) + (p.z - a.z) * (p.z - a.z);
+				if (d > best) { best = d; b = p; }
+			}
+			XMFLOAT3 c = b;
+			best = -1.0f;
+			for (size_t i = begin; i < end; i++)
+			{
+				const XMFLOAT3& p = position(i);
+				float d = (p.x - b.x) * (p.x - b.x) + (p.y - b.y) * (p.y - b.y) + (p.z - b.z) * (p.z - b.z);
+				if (d > best) { best = d; c = p; }
+			}
+			XMFLOAT3 center((b.x + c.x) * 0.5f, (b.y + c.y) * 0.5f, (b.z + c.z) * 0.5f);
+			float radius = sqrtf(best) * 0.5f;
+			for (size_t i = begin; i < end; i++)
+			{
+				const XMFLOAT3& p = position(i);
+				float dx = p.x - center.x, dy = p.y - center.y, dz = p.z - center.z;
+				float d = sqrtf(dx * dx + dy * dy + dz * dz);
+				if (d > radius)
+				{
+					// grow the sphere just enough to include p
+					float newRadius = (radius + d) * 0.5f;
+					float shift = (newRadius - radius) / d;
+					center.x += dx * shift;
+					center.y += dy * shift;
+					center.z += dz * shift;
+					radius = newRadius;
+				}
+			}
+			cluster.center = center;
+			cluster.radius = radius;
+
+			// normal cone from the unit triangle normals
+			vector<XMFLOAT3> normals;
+			normals.reserve(cluster.indexCount / 3);
+			XMFLOAT3 axis(0.0f, 0.0f, 0.0f);
+			for (size_t i = begin; i < end; i += 3)
+			{
+				const XMFLOAT3& p0 = position(i);
+				const XMFLOAT3& p1 = position(i + 1);
+				const XMFLOAT3& p2 = position(i + 2);
+				float e1x = p1.x - p0.x, e1y = p1.y - p0.y, e1z = p1.z - p0.z;
+				float e2x = p2.x - p0.x, e2y = p2.y - p0.y, e2z = p2.z - p0.z;
+				XMFLOAT3 n(e1y * e2z - e1z * e2y, e1z * e2x - e1x * e2z, e1x * e2y - e1y * e2x);
+				float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+				if (length == 0.0f)
+					continue;
+				n = XMFLOAT3(n.x / length, n.y / length, n.z / length);
+				normals.push_back(n);
+				axis.x += n.x;
+				axis.y += n.y;
+				axis.z += n.z;
+			}
+
+			float axisLength = sqrtf(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+			if (axisLength > 0.0f && !normals.empty())
+			{
+				axis = XMFLOAT3(axis.x / axisLength, axis.y / axisLength, axis.z / axisLength);
+
+				float minDot = 1.0f;
+				for (const XMFLOAT3& n : normals)
+					minDot = std::min(minDot, n.x * axis.x + n.y * axis.y + n.z * axis.z);
+
+				// only cones narrower than a hemisphere can cull anything
+				if (minDot > 0.0f)
+				{
+					// push the apex back so every triangle plane is in front of it
+					float maxT = 0.0f;
+					size_t n = 0;
+					for (size_t i = begin; i < end && n < normals.size(); i += 3)
+					{
+						const XMFLOAT3& p0 = position(i);
+						const XMFLOAT3& p1 = position(i + 1);
+						const XMFLOAT3& p2 = position(i + 2);
+						float e1x = p1.x - p0.x, e1y = p1.y - p0.y, e1z = p1.z - p0.z;
+						float e2x = p2.x - p0.x, e2y = p2.y - p0.y, e2z = p2.z - p0.z;
+						if (e1y * e2z - e1z * e2y == 0.0f && e1z * e2x - e1x * e2z == 0.0f && e1x * e2y - e1y * e2x == 0.0f)
+							continue;
+						const XMFLOAT3& tn = normals[n++];
+						float dc = (center.x - p0.x) * tn.x + (center.y - p0.y) * tn.y + (center.z - p0.z) * tn.z;
+						float dn = axis.x * tn.x + axis.y * tn.y + axis.z * tn.z;
+						maxT = std::max(maxT, dc / dn);
+					}
+
+					cluster.coneAxis = axis;
+					cluster.coneApex = XMFLOAT3(center.x - axis.x * maxT, center.y - axis.y * maxT, center.z - axis.z * maxT);
+					cluster.coneCutoff = sqrtf(1.0f - minDot * minDot);
+				}
+			}
+
+			clusters.push_back(cluster);
+		}
+	}
+
+	// Frustum planes are (normal, d) in the mesh's object space with the normals
+	// pointing inside, a point p is inside when dot(normal, p) + d >= 0
+	inline bool ClusterVisible(const MeshCluster& cluster, const XMFLOAT4 planes[6], const XMFLOAT3& viewer)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			const XMFLOAT4& plane = planes[i];
+			float distance = plane.x * cluster.center.x + plane.y * cluster.center.y + plane.z * cluster.center.z + plane.w;
+			if (distance < -cluster.radius)
+				return false;
+		}
+
+		if (cluster.coneCutoff < 1.0f)
+		{
+			float dx = cluster.coneApex.x - viewer.x;
+			float dy = cluster.coneApex.y - viewer.y;
+			float dz = cluster.coneApex.z - viewer.z;
+			float length = sqrtf(dx * dx + dy * dy + dz * dz);
+			if (length > 0.0f &&
+				(dx * cluster.coneAxis.x + dy * cluster.coneAxis.y + dz * cluster.coneAxis.z) >= cluster.coneCutoff * length)
+				return false;
+		}
+		return true;
+	}
+
+	const uint32_t MESH_CLUSTER_FILE_VERSION = 1;
+
+	// Binary cluster block: version, count, then the raw MeshCluster array
+	inline void WriteMeshClusters(std::ostream& out, const vector<MeshCluster>& clusters)
+	{
+		uint32_t header[2] = { MESH_CLUSTER_FILE_VERSION, (uint32_t)clusters.size() };
+		out.write((const char*)header, sizeof(header));
+		if (!clusters.empty())
+			out.write((const char*)clusters.data(), clusters.size() * sizeof(MeshCluster));
+	}
+
+	inline bool ReadMeshClusters(std::istream& in, vector<MeshCluster>& clusters)
+	{
+		uint32_t header[2] = {};
+		if (!in.read((char*)header, sizeof(header)) || header[0] != MESH_CLUSTER_FILE_VERSION)
+			return false;
+
+		// grow with the clusters actually read so a corrupt count can not
+		// allocate more than the stream holds
+		const uint32_t chunk = 4096;
+		clusters.clear();
+		for (uint32_t read = 0; read < header[1];)
+		{
+			uint32_t count = std::min(chunk, header[1] - read);
+			clusters.resize(read + count);
+			if (!in.read((char*)(clusters.data() + read), count * sizeof(MeshCluster)))
+			{
+				clusters.clear();
+				return false;
+			}
+			read += count;
+		}
+		return true;
+	}
+
+	// Unnormalized face normal, twice the triangle area long
+	inline XMFLOAT3 TriangleNormal(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+	{
+		float e1x = b.x - a.x, e1y = b.y - a.y, e1z = b.z - a.z;
+		float e2x = c.x - a.x, e2y = c.y - a.y, e2z = c.z - a.z;
+
+		return XMFLOAT3(e1y * e2z - e1z * e2y, e1z * e2x - e1x * e2z, e1x * e2y - e1y * e2x);
+	}
+
+	// Symmetric 4x4 plane quadric (Garland-Heckbert), weight is the summed
+	// triangle area so that Evaluate / weight is a mean squared distance
+	struct Quadric
+	{
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+	};
+
+	inline void AddPlane(Quadric& q, double a, double b, double c, double d, double w)
+	{
+		q.a2 += a * a * w; q.ab += a * b * w; q.ac += a * c * w; q.ad += a * d * w;
+		q.b2 += b * b * w; q.bc += b * c * w; q.bd += b * d * w;
+		q.c2 += c * c * w; q.cd += c * d * w;
+		q.d2 += d * d * w;
+	}
+
+	inline void AddQuadric(Quadric& q, const Quadric& o)
+	{
+		q.a2 += o.a2; q.ab += o.ab; q.ac += o.ac; q.ad += o.ad;
+		q.b2 += o.b2; q.bc += o.bc; q.bd += o.bd;
+		q.c2 += o.c2; q.cd += o.cd;
+		q.d2 += o.d2;
+		q.weight += o.weight;
+	}
+
+	inline double EvaluateQuadric(const Quadric& q, const XMFLOAT3& p)
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z
+			+ 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z)
+			+ 2.0 * (q.ad * x + q.bd * y + q.cd * z) + q.d2;
+		return e > 0.0 ? e : 0.0;
+	}
+
+	// Squared attribute distance between two vertices at the same position,
+	// the simplifier uses it to keep normals, uvs and skin weights intact
+	inline float AttributeDistanceSq(const SimpleVertex& a, const SimpleVertex& b)
+	{
+		float nx = a.Normal.x - b.Normal.x, ny = a.Normal.y - b.Normal.y, nz = a.Normal.z - b.Normal.z;
+		float u = a.Tex.x - b.Tex.x, v = a.Tex.y - b.Tex.y;
+		return nx * nx + ny * ny + nz * nz + u * u + v * v;
+	}
+
+	// Sum of squared weight differences per joint over both influence sets
+	inline float SkinWeightDistanceSq(const int indicesA[4], const float weightsA[4], const int indicesB[4], const float weightsB[4])
+	{
+		float result = 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			float other = 0.0f;
+			for (int j = 0; j < 4; j++)
+				if (indicesB[j] == indicesA[i])
+					other += weightsB[j];
+			float d = weightsA[i] - other;
+			result += d * d;
+		}
+		for (int j = 0; j < 4; j++)
+		{
+			bool shared = false;
+			for (int i = 0; i < 4; i++)
+				shared |= (indicesA[i] == indicesB[j] && weightsA[i] != 0.0f);
+			if (!shared)
+				result += weightsB[j] * weightsB[j];
+		}
+		return result;
+	}
+
+	inline float AttributeDistanceSq(const SkinnedVertex& a, const SkinnedVertex& b)
+	{
+		float nx = a.Normal.x - b.Normal.x, ny = a.Normal.y - b.Normal.y, nz = a.Normal.z - b.Normal.z;
+		float u = a.Tex.x - b.Tex.x, v = a.Tex.y - b.Tex.y;
+		const int indicesA[4] = { a.indices.x, a.indices.y, a.indices.z, a.indices.w };
+		const int indicesB[4] = { b.indices.x, b.indices.y, b.indices.z, b.indices.w };
+		const float weightsA[4] = { a.weights.x, a.weights.y, a.weights.z, a.weights.w };
+		const float weightsB[4] = { b.weights.x, b.weights.y, b.weights.z, b.weights.w };
+		return nx * nx + ny * ny + nz * nz + u * u + v * v + SkinWeightDistanceSq(indicesA, weightsA, indicesB, weightsB);
+	}
+
+	inline float AttributeDistanceSq(const SkinnedVertexCompact& a, const SkinnedVertexCompact& b)
+	{
+		float nx = a.Normal.x - b.Normal.x, ny = a.Normal.y - b.Normal.y, nz = a.Normal.z - b.Normal.z;
+		float u = a.Tex.x - b.Tex.x, v = a.Tex.y - b.Tex.y;
+		int indicesA[4], indicesB[4];
+		float weightsA[4], weightsB[4];
+		for (int i = 0; i < 4; i++)
+		{
+			indicesA[i] = a.indices[i];
+			indicesB[i] = b.indices[i];
+			weightsA[i] = a.weights[i] / 255.0f;
+			weightsB[i] = b.weights[i] / 255.0f;
+		}
+		return nx * nx + ny * ny + nz * nz + u * u + v * v + SkinWeightDistanceSq(indicesA, weightsA, indicesB, weightsB);
+	}
+
+	// Scales the attribute distance into squared mesh diagonals before it
+	// is added to the geometric error of a collapse
+	const float DEFAULT_LOD_ATTRIBUTE_WEIGHT = 0.01f;
+	// Open borders are held in place by planes weighted this much heavier
+	const double LOD_BOUNDARY_WEIGHT = 10.0;
+
+	// Quadric error edge collapse on a triangle list. Vertices that share a
+	// position are collapsed together, each of their attribute variants is
+	// mapped onto the closest variant at the target so uv and normal seams
+	// survive, and the attribute distance is part of the collapse cost.
+	// Collapses are half edge (onto an existing vertex) so the vertex buffer
+	// is left untouched and can be shared by every LOD.
+	// Returns the largest geometric error in mesh units.
+	template <typename T>
+	float SimplifyIndices(const vector<T>& vertices, vector<int>& indices, size_t targetTriangleCount,
+		float attributeWeight = DEFAULT_LOD_ATTRIBUTE_WEIGHT)
+	{
+		const size_t triCount = indices.size() / 3;
+		if (triCount <= targetTriangleCount || vertices.empty())
+			return 0.0f;
+
+		// group the vertices that share a position
+		vector<int> order(vertices.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = (int)i;
+		auto positionLess = [&](int a, int b)
+		{
+			const XMFLOAT3& pa = vertices[a].Pos;
+			const XMFLOAT3& pb = vertices[b].Pos;
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			return pa.z < pb.z;
+		};
+		std::sort(order.begin(), order.end(), positionLess);
+
+		vector<int> posId(vertices.size());
+		vector<int> wedgeStart;
+		vector<XMFLOAT3> positions;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			if (i == 0 || positionLess(order[i - 1], order[i]))
+			{
+				wedgeStart.push_back((int)i);
+				positions.push_back(vertices[order[i]].Pos);
+			}
+			posId[order[i]] = (int)positions.size() - 1;
+		}
+		const int posCount = (int)positions.size();
+		wedgeStart.push_back((int)order.size());
+
+		// triangles around each position
+		vector<vector<int>> adjacency(posCount);
+		vector<uint8_t> triAlive(triCount, 1);
+		for (size_t t = 0; t < triCount; t++)
+		{
+			int p0 = posId[indices[t * 3]], p1 = posId[indices[t * 3 + 1]], p2 = posId[indices[t * 3 + 2]];
+			adjacency[p0].push_back((int)t);
+			if (p1 != p0)
+				adjacency[p1].push_back((int)t);
+			if (p2 != p0 && p2 != p1)
+				adjacency[p2].push_back((int)t);
+		}
+
+		XMFLOAT3 boundsMin = positions[0], boundsMax = positions[0];
+		for (const XMFLOAT3& p : positions)
+		{
+			boundsMin = XMFLOAT3(std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z));
+			boundsMax = XMFLOAT3(std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z));
+		}
+		float dx = boundsMax.x - boundsMin.x, dy = boundsMax.y - boundsMin.y, dz = boundsMax.z - boundsMin.z;
+		const double attributeScale = (double)attributeWeight * (dx * dx + dy * dy + dz * dz);
+
+		// area weighted face planes
+		vector<Quadric> quadrics(posCount);
+		for (size_t t = 0; t < triCount; t++)
+		{
+			int p[3] = { posId[indices[t * 3]], posId[indices[t * 3 + 1]], posId[indices[t * 3 + 2]] };
+			XMFLOAT3 n = TriangleNormal(positions[p[0]], positions[p[1]], positions[p[2]]);
+			float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+			if (length == 0.0f)
+				continue;
+			XMFLOAT3 normal(n.x / length, n.y / length, n.z / length);
+			double d = -(normal.x * positions[p[0]].x + normal.y * positions[p[0]].y + normal.z * positions[p[0]].z);
+			double area = length * 0.5;
+			for (int k = 0; k < 3; k++)
+			{
+				AddPlane(quadrics[p[k]], normal.x, normal.y, normal.z, d, area);
+				quadrics[p[k]].weight += area;
+			}
+		}
+
+		// edges used by a single triangle are open borders, add a plane
+		// through the edge perpendicular to the face to keep them in place
+		vector<uint64_t> edges;
+		edges.reserve(triCount * 3);
+		auto edgeKey = [](int a, int b) { return ((uint64_t)(uint32_t)std::min(a, b) << 32) | (uint32_t)std::max(a, b); };
+		for (size_t t = 0; t < triCount; t++)
+			for (int k = 0; k < 3; k++)
+			{
+				int a = posId[indices[t * 3 + k]], b = posId[indices[t * 3 + (k + 1) % 3]];
+				if (a != b)
+					edges.push_back(edgeKey(a, b));
+			}
+		std::sort(edges.begin(), edges.end());
+		for (size_t t = 0; t < triCount; t++)
+		{
+			int p[3] = { posId[indices[t * 3]], posId[indices[t * 3 + 1]], posId[indices[t * 3 + 2]] };
+			XMFLOAT3 fn = TriangleNormal(positions[p[0]], positions[p[1]], positions[p[2]]);
+			if (fn.x == 0.0f && fn.y == 0.0f && fn.z == 0.0f)
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				int a = p[k], b = p[(k + 1) % 3];
+				if (a == b)
+					continue;
+				auto range = std::equal_range(edges.begin(), edges.end(), edgeKey(a, b));
+				if (range.second - range.first != 1)
+					continue;
+
+				const XMFLOAT3& pa = positions[a];
+				const XMFLOAT3& pb = positions[b];
+				float ex = pb.x - pa.x, ey = pb.y - pa.y, ez = pb.z - pa.z;
+				XMFLOAT3 normal(ey * fn.z - ez * fn.y, ez * fn.x - ex * fn.z, ex * fn.y - ey * fn.x);
+				float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+				normal = XMFLOAT3(normal.x / length, normal.y / length, normal.z / length);
+				double d = -(normal.x * pa.x + normal.y * pa.y + normal.z * pa.z);
+				double w = LOD_BOUNDARY_WEIGHT * (ex * ex + ey * ey + ez * ez);
+				AddPlane(quadrics[a], normal.x, normal.y, normal.z, d, w);
+				AddPlane(quadrics[b], normal.x, normal.y, normal.z, d, w);
+			}
+		}
+
+		// closest attribute variant of 'to' for every variant of 'from'
+		auto attributeError = [&](int from, int to) -> double
+		{
+			double error = 0.0;
+			for (int i = wedgeStart[from]; i < wedgeStart[from + 1]; i++)
+			{
+				float best = FLT_MAX;
+				for (int j = wedgeStart[to]; j < wedgeStart[to + 1]; j++)
+					best = std::min(best, AttributeDistanceSq(vertices[order[i]], vertices[order[j]]));
+				error += best;
+			}
+			return error;
+		};
+
+		auto geometricError = [&](int from, int to) -> double
+		{
+			Quadric q = quadrics[from];
+			AddQuadric(q, quadrics[to]);
+			return EvaluateQuadric(q, positions[to]) / std::max(q.weight, 1e-30);
+		};
+
+		struct Collapse
+		{
+			double cost;
+			int from, to;
+			uint32_t fromStamp, toStamp;
+			bool operator<(const Collapse& rhs) const { return cost > rhs.cost; }
+		};
+		vector<uint32_t> stamps(posCount, 0);
+		vector<uint8_t> removed(posCount, 0);
+		std::priority_queue<Collapse> queue;
+
+		auto pushCollapse = [&](int from, int to)
+		{
+			double cost = geometricError(from, to) + attributeScale * attributeError(from, to);
+			queue.push({ cost, from, to, stamps[from], stamps[to] });
+		};
+
+		for (size_t t = 0; t < triCount; t++)
+			for (int k = 0; k < 3; k++)
+			{
+				int a = posId[indices[t * 3 + k]], b = posId[indices[t * 3 + (k + 1) % 3]];
+				if (a != b)
+				{
+					pushCollapse(a, b);
+					pushCollapse(b, a);
+				}
+			}
+
+		// moving 'from' onto 'to' must not flip or degenerate a remaining triangle
+		auto collapseValid = [&](int from, int to)
+		{
+			for (int t : adjacency[from])
+			{
+				if (!triAlive[t])
+					continue;
+				int p[3] = { posId[indices[t * 3]], posId[indices[t * 3 + 1]], posId[indices[t * 3 + 2]] };
+				if (p[0] == to || p[1] == to || p[2] == to)
+					continue;
+
+				const XMFLOAT3& a = positions[p[0]];
+				const XMFLOAT3& b = positions[p[1]];
+				const XMFLOAT3& c = positions[p[2]];
+				XMFLOAT3 n0 = TriangleNormal(a, b, c);
+				XMFLOAT3 n1 = TriangleNormal(p[0] == from ? positions[to] : a,
+					p[1] == from ? positions[to] : b, p[2] == from ? positions[to] : c);
+				if (n0.x * n1.x + n0.y * n1.y + n0.z * n1.z <= 0.0f)
+					return false;
+			}
+			return true;
+		};
+
+		vector<int> wedgeRemap(vertices.size(), -1);
+		vector<int> neighbours;
+		size_t aliveCount = triCount;
+		double maxError = 0.0;
+
+		while (aliveCount > targetTriangleCount && !queue.empty())
+		{
+			Collapse c = queue.top();
+			queue.pop();
+
+			if (removed[c.from] || removed[c.to] || stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp)
+				continue;
+			if (!collapseValid(c.from, c.to))
+				continue;
+
+			for (int i = wedgeStart[c.from]; i < wedgeStart[c.from + 1]; i++)
+			{
+				float best = FLT_MAX;
+				for (int j = wedgeStart[c.to]; j < wedgeStart[c.to + 1]; j++)
+				{
+					float d = AttributeDistanceSq(vertices[order[i]], vertices[order[j]]);
+					if (d < best)
+					{
+						best = d;
+						wedgeRemap[order[i]] = order[j];
+					}
+				}
+			}
+
+			maxError = std::max(maxError, geometricError(c.from, c.to));
+
+			for (int t : adjacency[c.from])
+			{
+				if (!triAlive[t])
+					continue;
+
+				int* tri = &indices[t * 3];
+				if (posId[tri[0]] == c.to || posId[tri[1]] == c.to || posId[tri[2]] == c.to)
+				{
+					triAlive[t] = 0;
+					aliveCount--;
+					continue;
+				}
+				for (int k = 0; k < 3; k++)
+					if (posId[tri[k]] == c.from)
+						tri[k] = wedgeRemap[tri[k]];
+				adjacency[c.to].push_back(t);
+			}
+
+			AddQuadric(quadrics[c.to], quadrics[c.from]);
+			removed[c.from] = 1;
+			adjacency[c.from].clear();
+			adjacency[c.from].shrink_to_fit();
+			stamps[c.to]++;
+
+			// drop the dead triangles and requeue every edge of the target
+			vector<int>& around = adjacency[c.to];
+			around.erase(std::remove_if(around.begin(), around.end(), [&](int t) { return !triAlive[t]; }), around.end());
+
+			neighbours.clear();
+			for (int t : around)
+				for (int k = 0; k < 3; k++)
+				{
+					int p = posId[indices[t * 3 + k]];
+					if (p != c.to)
+						neighbours.push_back(p);
+				}
+			std::sort(neighbours.begin(), neighbours.end());
+			neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+			for (int n : neighbours)
+			{
+				pushCollapse(n, c.to);
+				pushCollapse(c.to, n);
+			}
+		}
+
+		size_t write = 0;
+		for (size_t t = 0; t < triCount; t++)
+		{
+			if (!triAlive[t])
+				continue;
+			for (int k = 0; k < 3; k++)
+				indices[write * 3 + k] = indices[t * 3 + k];
+			write++;
+		}
+		indices.resize(write * 3);
+
+		return (float)sqrt(maxError);
+	}
+
+	// Appends a simplified copy of the mesh for every ratio (of the original
+	// triangle count) to the index buffer and fills one range per level,
+	// lods[0] is the full mesh. All levels share the vertex buffer and each
+	// level is simplified from the previous one, so errors only grow.
+	// Stops early when the simplifier can not reach the next ratio.
+	template <typename T>
+	void GenerateLods(SimpleMesh<T>& simpleMesh, vector<MeshLod>& lods,
+		const vector<float>& ratios = { 0.5f, 0.25f, 0.125f }, float attributeWeight = DEFAULT_LOD_ATTRIBUTE_WEIGHT)
+	{
+		const size_t indexCount = GetIndexCount(simpleMesh);
+		vector<int> current(indexCount);
+		for (size_t i = 0; i < indexCount; i++)
+			current[i] = GetIndex(simpleMesh, i);
+
+		vector<int> all = current;
+		lods.clear();
+		lods.push_back({ 0, (uint32_t)indexCount, 0.0f });
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (float ratio : ratios)
+		{
+			size_t target = (size_t)(indexCount / 3 * ratio);
+			float error = SimplifyIndices(simpleMesh.vertexList, current, target, attributeWeight);
+			if (current.size() >= lods.back().indexCount)
+				break;
+
+			vector<int> lodIndices = current;
+			OptimizeVertexCacheIndices(lodIndices, simpleMesh.vertexList.size());
+
+			MeshLod lod;
+			lod.indexStart = (uint32_t)all.size();
+			lod.indexCount = (uint32_t)lodIndices.size();
+			lod.error = std::max(error, lods.back().error);
+			lods.push_back(lod);
+			all.insert(all.end(), lodIndices.begin(), lodIndices.end());
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		for (size_t i = 0; i < lods.size(); i++)
+			cout << "LOD " << i << ": " << lods[i].indexCount / 3 << " triangles, error " << lods[i].error << endl;
+		cout << "LOD generation: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+
+		if (!simpleMesh.indicesList16.empty())
+			simpleMesh.indicesList16.assign(all.begin(), all.end());
+		else
+			simpleMesh.indicesList = all;
 	}
 
 	template <typename T>
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// File: Packed_VS.hlsl
+//
+// Vertex shader for the PackedVertex16 / PackedVertex24 formats in MeshUtils.h
+//--------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffer Variables
+//--------------------------------------------------------------------------------------
+
+cbuffer ConstantBufferTransforms : register(b0)
+{
+    matrix World;
+    matrix View;
+    matrix Projection;
+}
+
+// decoded = min + encoded * extent, identity for unquantized attributes.
+// b1 is the joint palette of the skinned shader.
+cbuffer PackedVertexBounds : register(b2)
+{
+    float4 posMin;
+    float4 posExtent;
+    float4 texMin;
+    float4 texExtent;
+};
+
+//--------------------------------------------------------------------------------------
+struct VS_INPUT
+{
+    float4 Pos : POSITION;  // R16G16B16A16_UNORM or R32G32B32_FLOAT
+    float2 Norm : NORMAL;   // R16G16_SNORM octahedral
+    float2 Tex : TEXCOORD0; // R16G16_UNORM or R32G32_FLOAT
+};
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float3 Norm : NORMAL;
+    float2 Tex : TEXCOORD1;
+};
+
+float3 DecodeOctahedral(float2 e)
+{
+    float3 n = float3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += (n.xy >= 0.0f) ? -t : t;
+    return normalize(n);
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex Shader
+//--------------------------------------------------------------------------------------
+PS_INPUT VS(VS_INPUT input)
+{
+    PS_INPUT output = (PS_INPUT) 0;
+    float3 pos = posMin.xyz + input.Pos.xyz * posExtent.xyz;
+    output.Pos = mul(float4(pos, 1.0f), World);
+    output.Pos = mul(output.Pos, View);
+    output.Pos = mul(output.Pos, Projection);
+    output.Norm = mul(DecodeOctahedral(input.Norm), (float3x3) World);
+    output.Tex = texMin.xy + input.Tex * texExtent.xy;
+    return output;
+}
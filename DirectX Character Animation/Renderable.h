@@ -6,6 +6,8 @@
 #include <fstream>
 #include <vector>
 #include "DDSTextureLoader.h"
+#include "MeshUtils.h"
+#include "CacheUtils.h"
 
 using namespace DirectX;
 using namespace std;
@@ -57,15 +59,41 @@ public:
 	UINT vertexSize = 0;
 	ComPtr<ID3D11Buffer> indexBuffer = nullptr;
 	int indexCount = 0;
+	DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;
 	D3D11_PRIMITIVE_TOPOLOGY primitiveTopology =
 		D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 
+	// Optional index buffer clusters for DrawClusters
+	vector<MeshCluster> clusters;
+	// Optional LOD ranges of the index buffer, clusters only cover lods[0]
+	vector<MeshLod> lods;
+	int currentLod = 0;
+	// Optional submesh ranges of a multi mesh file for DrawSubMeshes, with
+	// one texture per material slot (null when the material has none).
+	// Draw then draws every submesh whole, so a renderable has either
+	// submeshes or clusters and LODs, not both.
+	vector<SubMesh> subMeshes;
+	vector<ComPtr<ID3D11ShaderResourceView>> materialViews;
+	// Skeleton joint of each palette entry of the skinned submeshes, see
+	// JointPalettes and DrawSkinned
+	vector<int> paletteJoints;
+	// Constant range of each submesh's palette in jointPaletteBufferVS, in
+	// 16 byte constants. With paletteOffsets every palette has its own range
+	// of one buffer, otherwise they all start at 0 and take turns.
+	vector<UINT> paletteFirstConstants;
+	vector<UINT> paletteConstantCounts;
+	bool paletteOffsets = false;
+
 	// Shader obejcts
 	ComPtr<ID3D11InputLayout> inputLayout = nullptr;
 	ComPtr<ID3D11VertexShader> vertexShader = nullptr;
 	ComPtr<ID3D11PixelShader> pixelShader = nullptr;
 	ComPtr<ID3D11Buffer> constantBufferVS = nullptr;
 	ComPtr<ID3D11Buffer> constantBufferPS = nullptr;
+	// VS slot 2, dequantization constants for packed vertex formats
+	ComPtr<ID3D11Buffer> vertexDecodeBufferVS = nullptr;
+	// VS slot 1, joint palettes of the skinned submeshes
+	ComPtr<ID3D11Buffer> jointPaletteBufferVS = nullptr;
 
 	// Shader Resources (Texture)
 	ComPtr<ID3D11ShaderResourceView> resourceView = nullptr;
@@ -106,19 +134,99 @@ public:
 		return hr;
 	}
 
+	HRESULT CreateBuffers(ID3D11Device* device, vector<uint16_t>& indices,
+		float* vertices, int vSize, int vCount)
+	{
+		HRESULT hr = S_OK;
+
+		hr = CreateIndexBuffer(device, indices);
+		if (FAILED(hr))
+			return hr;
+
+		hr = CreateVertexBuffer(device, vertices, vSize, vCount);
+		return hr;
+	}
+
+	// Creates the buffers from a SimpleMesh, using its 16 bit
+	// indices when MeshUtils::CompactIndices has filled them
+	template <typename Mesh>
+	HRESULT CreateBuffers(ID3D11Device* device, Mesh& mesh)
+	{
+		int vSize = (int)sizeof(mesh.vertexList[0]);
+		int vCount = (int)mesh.vertexList.size();
+
+		if (!mesh.indicesList16.empty())
+			return CreateBuffers(device, mesh.indicesList16, (float*)mesh.vertexList.data(), vSize, vCount);
+
+		return CreateBuffers(device, mesh.indicesList, (float*)mesh.vertexList.data(), vSize, vCount);
+	}
+
+	// Uploads straight from a mapped mesh cache and takes over its
+	// clusters, LOD ranges and vertex decode constants
+	HRESULT CreateBuffers(ID3D11Device* device, const MeshCacheView& cache)
+	{
+		HRESULT hr = S_OK;
+		const MeshCacheHeader& header = *cache.header;
+
+		indexFormat = (header.indexSize == sizeof(uint16_t)) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+		hr = CreateIndexBuffer(device, cache.indices, header.indexSize, (int)header.indexCount);
+		if (FAILED(hr))
+			return hr;
+
+		hr = CreateVertexBuffer(device, (float*)cache.vertices, (int)header.vertexStride, (int)header.vertexCount);
+		if (FAILED(hr))
+			return hr;
+
+		clusters.assign(cache.clusters, cache.clusters + header.clusterCount);
+		lods.assign(cache.lods, cache.lods + header.lodCount);
+
+		if (cache.decodeData)
+			hr = CreateVertexDecodeBufferVS(device, cache.decodeData, header.decodeSize);
+		return hr;
+	}
+
+	// Uploads 16 bit indices when every index fits, 32 bit otherwise
 	HRESULT CreateIndexBuffer(ID3D11Device* device, vector<int>& indices)
+	{
+		bool fits16 = true;
+		for (int index : indices)
+		{
+			if (index < 0 || index > 0xffff)
+			{
+				fits16 = false;
+				break;
+			}
+		}
+
+		if (fits16)
+		{
+			vector<uint16_t> indices16(indices.begin(), indices.end());
+			return CreateIndexBuffer(device, indices16);
+		}
+
+		indexFormat = DXGI_FORMAT_R32_UINT;
+		return CreateIndexBuffer(device, indices.data(), sizeof(int), (int)indices.size());
+	}
+
+	HRESULT CreateIndexBuffer(ID3D11Device* device, vector<uint16_t>& indices)
+	{
+		indexFormat = DXGI_FORMAT_R16_UINT;
+		return CreateIndexBuffer(device, indices.data(), sizeof(uint16_t), (int)indices.size());
+	}
+
+	HRESULT CreateIndexBuffer(ID3D11Device* device, const void* indices, UINT indexSize, int count)
 	{
 		HRESULT hr = S_OK;
 
-		indexCount = (int)indices.size();
+		indexCount = count;
 		D3D11_BUFFER_DESC bd = {};
 		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(int) * indexCount;
+		bd.ByteWidth = indexSize * indexCount;
 		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
 		bd.CPUAccessFlags = 0;
 
 		D3D11_SUBRESOURCE_DATA InitData = {};
-		InitData.pSysMem = indices.data();
+		InitData.pSysMem = indices;
 		hr = device->CreateBuffer(&bd, &InitData,
 			indexBuffer.ReleaseAndGetAddressOf());
 		return hr;
@@ -186,6 +294,60 @@ public:
 		return CreateConstantBuffer(device, size, &constantBufferPS);
 	}
 
+	// Takes the submeshes and palettes of a skinned mesh and creates a
+	// dynamic palette buffer, jointSize bytes (a multiple of 16) per palette
+	// entry. Each palette gets a range rounded up to the 16 constants that
+	// VSSetConstantBuffers1 offsets and sizes come in. When the device can
+	// bind constant buffer ranges (D3D11.1) the ranges are laid out one after
+	// the other, otherwise the buffer holds the largest range and every
+	// submesh reuses it.
+	HRESULT CreateJointPalettes(ID3D11Device* device, const JointPalettes& palettes, UINT jointSize)
+	{
+		if (palettes.MaxPaletteCount() > (UINT)MAX_PALETTE_JOINTS || jointSize % 16 != 0)
+			return E_INVALIDARG;
+
+		subMeshes = palettes.subMeshes;
+		paletteJoints = palettes.joints;
+
+		D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+		paletteOffsets = SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) &&
+			options.ConstantBufferOffsetting;
+
+		paletteFirstConstants.clear();
+		paletteConstantCounts.clear();
+		UINT bufferConstants = 0;
+		for (const SubMesh& subMesh : subMeshes)
+		{
+			UINT constants = std::max(subMesh.paletteCount, 1u) * (jointSize / 16);
+			constants = (constants + 15) & ~15u;
+			paletteFirstConstants.push_back(paletteOffsets ? bufferConstants : 0);
+			paletteConstantCounts.push_back(constants);
+			bufferConstants = paletteOffsets ? bufferConstants + constants : std::max(bufferConstants, constants);
+		}
+
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_DYNAMIC;
+		bd.ByteWidth = bufferConstants * 16;
+		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		return device->CreateBuffer(&bd, nullptr, jointPaletteBufferVS.ReleaseAndGetAddressOf());
+	}
+
+	// Immutable constant buffer with the decode constants of a packed vertex format
+	HRESULT CreateVertexDecodeBufferVS(ID3D11Device* device, const void* data, UINT size)
+	{
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_IMMUTABLE;
+		bd.ByteWidth = size;
+		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bd.CPUAccessFlags = 0;
+
+		D3D11_SUBRESOURCE_DATA InitData = {};
+		InitData.pSysMem = data;
+		return device->CreateBuffer(&bd, &InitData,
+			vertexDecodeBufferVS.ReleaseAndGetAddressOf());
+	}
+
 	HRESULT CreateConstantBuffer(ID3D11Device* device, UINT size, ID3D11Buffer **constantBuffer)
 	{
 		HRESULT hr = S_OK;
@@ -212,6 +374,29 @@ public:
 		return hr;
 	}
 
+	// Loads the texture of each material slot from directory, a missing
+	// texture leaves its slot null so DrawSubMeshes keeps the bound one
+	HRESULT CreateMaterialTextures(ID3D11Device* device, const vector<MeshMaterial>& materials, const std::string& directory)
+	{
+		HRESULT result = S_OK;
+
+		materialViews.clear();
+		materialViews.resize(materials.size());
+		for (size_t i = 0; i < materials.size(); i++)
+		{
+			if (materials[i].textureFilename == "")
+				continue;
+
+			std::string filename = directory + materials[i].textureFilename;
+			std::wstring widestr = std::wstring(filename.begin(), filename.end());
+			HRESULT hr = CreateDDSTextureFromFile(device, widestr.c_str(), nullptr,
+				materialViews[i].ReleaseAndGetAddressOf());
+			if (FAILED(hr))
+				result = hr;
+		}
+		return result;
+	}
+
 	HRESULT CreateDefaultSampler(ID3D11Device* device)
 	{
 		HRESULT hr = S_OK;
@@ -237,6 +422,10 @@ public:
 			context->VSSetConstantBuffers(0, 1, constantBufferVS.GetAddressOf());
 		if (constantBufferPS)
 			context->PSSetConstantBuffers(0, 1, constantBufferPS.GetAddressOf());
+		if (vertexDecodeBufferVS)
+			context->VSSetConstantBuffers(2, 1, vertexDecodeBufferVS.GetAddressOf());
+		if (jointPaletteBufferVS)
+			context->VSSetConstantBuffers(1, 1, jointPaletteBufferVS.GetAddressOf());
 		if (inputLayout)
 			context->IASetInputLayout(inputLayout.Get());
 		if (vertexShader)
@@ -258,19 +447,165 @@ public:
 				&offset);
 		// Set index buffer
 		if (indexBuffer)
-			context->IASetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+			context->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
 		// Set primitive topology
 		context->IASetPrimitiveTopology(primitiveTopology);
 	}
 
+	// Picks the coarsest LOD whose error projects to at most maxPixelError
+	// pixels at the distance of the object's origin
+	int SelectLod(const XMMATRIX& view, const XMMATRIX& projection, float viewportHeight, float maxPixelError = 1.0f)
+	{
+		currentLod = 0;
+		if (lods.empty())
+			return currentLod;
+
+		XMVECTOR viewPos = XMVector3TransformCoord(world.r[3], view);
+		float distance = std::max(XMVectorGetX(XMVector3Length(viewPos)), 1e-4f);
+		float worldScale = XMVectorGetX(XMVector3Length(world.r[0]));
+		float pixelsPerUnit = XMVectorGetY(projection.r[1]) * viewportHeight * 0.5f / distance;
+
+		for (int i = 1; i < (int)lods.size(); i++)
+			if (lods[i].error * worldScale * pixelsPerUnit <= maxPixelError)
+				currentLod = i;
+		return currentLod;
+	}
+
 	void Draw(ID3D11DeviceContext* context)
 	{
-		if (indexBuffer)
+		if (indexBuffer && !subMeshes.empty())
+		{
+			assert(clusters.empty() && lods.empty());
+			DrawSubMeshes(context);
+		}
+		else if (indexBuffer && currentLod > 0 && currentLod < (int)lods.size())
+			context->DrawIndexed(lods[currentLod].indexCount, lods[currentLod].indexStart, 0);
+		else if (indexBuffer && !lods.empty())
+			context->DrawIndexed(lods[0].indexCount, 0, 0);
+		else if (indexBuffer)
 			context->DrawIndexed(indexCount, 0, 0);
 		else if (vertexBuffer)
 			context->Draw(vertexCount, 0);
 	}
 
+	// Draws every submesh from the buffers bound once by Bind, switching the
+	// texture only when the material slot changes. beforeDraw(subMesh) runs
+	// ahead of each draw.
+	template <typename BeforeDraw>
+	void DrawSubMeshes(ID3D11DeviceContext* context, BeforeDraw beforeDraw)
+	{
+		uint32_t boundSlot = UINT32_MAX;
+		for (const SubMesh& subMesh : subMeshes)
+		{
+			if (subMesh.materialSlot != boundSlot && subMesh.materialSlot < materialViews.size() &&
+				materialViews[subMesh.materialSlot])
+			{
+				context->PSSetShaderResources(0, 1, materialViews[subMesh.materialSlot].GetAddressOf());
+				boundSlot = subMesh.materialSlot;
+			}
+			beforeDraw(subMesh);
+			context->DrawIndexed(subMesh.indexCount, subMesh.indexStart, subMesh.baseVertex);
+		}
+	}
+
+	void DrawSubMeshes(ID3D11DeviceContext* context)
+	{
+		DrawSubMeshes(context, [](const SubMesh&) {});
+	}
+
+	// Draws a skinned mesh one submesh at a time, each with its own joint
+	// palette: writePalette(joints, count, data) fills count entries at data
+	// for the skeleton joints of the submesh. The entries past them up to
+	// the end of the range are left undefined by the discard and are never
+	// indexed. With paletteOffsets every palette is written in one map and
+	// each draw binds its range, otherwise the buffer is mapped per draw.
+	template <typename WritePalette>
+	void DrawSkinned(ID3D11DeviceContext* context, WritePalette writePalette)
+	{
+		ComPtr<ID3D11DeviceContext1> context1;
+		if (paletteOffsets && SUCCEEDED(context->QueryInterface(IID_PPV_ARGS(&context1))))
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			if (FAILED(context->Map(jointPaletteBufferVS.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+				return;
+			for (size_t i = 0; i < subMeshes.size(); ++i)
+			{
+				writePalette(paletteJoints.data() + subMeshes[i].paletteStart, (int)subMeshes[i].paletteCount,
+					(uint8_t*)mapped.pData + (size_t)paletteFirstConstants[i] * 16);
+			}
+			context->Unmap(jointPaletteBufferVS.Get(), 0);
+
+			DrawSubMeshes(context, [&](const SubMesh& subMesh)
+			{
+				size_t i = &subMesh - subMeshes.data();
+				context1->VSSetConstantBuffers1(1, 1, jointPaletteBufferVS.GetAddressOf(), &paletteFirstConstants[i], &paletteConstantCounts[i]);
+			});
+			return;
+		}
+
+		DrawSubMeshes(context, [&](const SubMesh& subMesh)
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			if (SUCCEEDED(context->Map(jointPaletteBufferVS.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+			{
+				writePalette(paletteJoints.data() + subMesh.paletteStart, (int)subMesh.paletteCount, mapped.pData);
+				context->Unmap(jointPaletteBufferVS.Get(), 0);
+			}
+		});
+	}
+
+	// Draws only the clusters that are inside the view frustum and not facing
+	// away from the camera, merging neighbouring visible clusters into one draw
+	void DrawClusters(ID3D11DeviceContext* context, const XMMATRIX& view, const XMMATRIX& projection)
+	{
+		if (clusters.empty() || !indexBuffer || currentLod > 0)
+		{
+			Draw(context);
+			return;
+		}
+
+		XMMATRIX worldView = XMMatrixMultiply(world, view);
+		XMMATRIX columns = XMMatrixTranspose(XMMatrixMultiply(worldView, projection));
+
+		// object space frustum planes from the columns of world * view * projection
+		XMVECTOR planeVectors[6] =
+		{
+			XMVectorAdd(columns.r[3], columns.r[0]),		// left
+			XMVectorSubtract(columns.r[3], columns.r[0]),	// right
+			XMVectorAdd(columns.r[3], columns.r[1]),		// bottom
+			XMVectorSubtract(columns.r[3], columns.r[1]),	// top
+			columns.r[2],									// near
+			XMVectorSubtract(columns.r[3], columns.r[2]),	// far
+		};
+		XMFLOAT4 planes[6];
+		for (int i = 0; i < 6; i++)
+			XMStoreFloat4(&planes[i], XMPlaneNormalize(planeVectors[i]));
+
+		XMFLOAT3 viewer;
+		XMStoreFloat3(&viewer, XMMatrixInverse(nullptr, worldView).r[3]);
+
+		UINT runStart = 0;
+		UINT runCount = 0;
+		for (const MeshCluster& cluster : clusters)
+		{
+			if (!MeshUtils::ClusterVisible(cluster, planes, viewer))
+				continue;
+
+			if (runCount && runStart + runCount == cluster.indexStart)
+			{
+				runCount += cluster.indexCount;
+				continue;
+			}
+
+			if (runCount)
+				context->DrawIndexed(runCount, runStart, 0);
+			runStart = cluster.indexStart;
+			runCount = cluster.indexCount;
+		}
+		if (runCount)
+			context->DrawIndexed(runCount, runStart, 0);
+	}
+
 	void DrawIndexed(ID3D11DeviceContext* context)
 	{
 		if (indexBuffer && vertexBuffer)
@@ -23,6 +23,9 @@
 #include "LineUtils.h"
 #include "Renderable.h"
 #include "LoaderUtils.h"
+#include "dev5_anim_reduce.h"
+#include "dev5_anim_compress.h"
+#include "dev5_skinning.h"
 #include "debug_renderer.h"
 #include "math_types.h"
 
@@ -41,6 +44,15 @@ bool RASTER_FILL_CULL_NONE = false;
 bool DEPTH_WRITE_ENABLED = true;
 bool DEBUG_VIEW_ENABLED = true;
 bool SKYBOX_ENABLED = false;
+bool BENCHMARK_MESH_WELDING = false;
+bool BENCHMARK_SKINNING_PALETTE = false;
+bool PACKED_VERTEX_FORMAT = true;
+bool CLUSTER_CULLING_ENABLED = true;
+bool LOD_SELECTION_ENABLED = true;
+// rock01 props through the mesh cache, packed vertices, clusters and LODs
+bool STATIC_MESH_ENABLED = true;
+// rowing boat, every mesh and material of the file in one buffer
+bool MULTI_MESH_ENABLED = true;
 
 //--------------------------------------------------------------------------------------
 // Global Variables
@@ -62,6 +74,7 @@ ID3D11PixelShader* g_pPixelShaderSolid = nullptr;
 XMMATRIX                g_World;
 XMMATRIX                g_View;
 XMMATRIX                g_Projection;
+float                   g_ViewportHeight = 768.0f;
 ID3D11RasterizerState* rasterStateDefault;
 ID3D11RasterizerState* rasterStateWireframe;
 ID3D11RasterizerState* rasterStateFillNoCull;
@@ -78,14 +91,18 @@ ID3D11Buffer* vertex_buffer;
 vector<Renderable> renderables;
 // Main mesh
 Renderable skinnedRenderable;
+// every clip of the character, anim_clip is the one playing
+clip_library_t clip_library;
 anim_clip_t anim_clip;
+// anim_clip with redundant keys removed and quantized, sampled at runtime
+compressed_clip_t compressed_clip;
+// playback state of the character, at half speed
+clip_instance_t character_playback = { 0.0f, 0.5f };
+// decoded, parent relative and model space pose of the current frame
+pose_t decoded_pose;
+std::vector<float4x4> local_pose;
+std::vector<float4x4> pose_transforms;
 
-struct alignas(16) joint_deltas_t
-{
-	XMMATRIX m[67];
-};
-joint_deltas_t joint_deltas;
-ID3D11Buffer* joint_deltas_CB = nullptr;
 
 // Grid mesh
 Renderable gridRenderable;
@@ -634,6 +651,7 @@ HRESULT InitDevice()
 	g_pImmediateContext->RSSetViewports(1, &vp);
 
 	// Initialize the projection matrix
+	g_ViewportHeight = (float)height;
 	g_Projection = XMMatrixPerspectiveFovLH(XM_PIDIV4, width / (FLOAT)height, 0.01f, 1000.0f);
 
 	return hr;
@@ -662,6 +680,27 @@ HRESULT InitContent()
 	InitFBX();
 	create_debug_line_buffer();
 
+	// compare the hashed and brute force vertex welding on the bundled assets
+	if (BENCHMARK_MESH_WELDING)
+	{
+		const char* benchmarkAssets[] =
+		{
+			".//Assets//cube.fbx",
+			".//Assets//barrel.fbx",
+			".//Assets//Chest1-1.fbx",
+			".//Assets//Character_Female_Pirate_01.fbx",
+			".//Assets//Run.fbx",
+		};
+
+		scale = 1.0f;
+		for (const char* asset : benchmarkAssets)
+			BenchmarkCompactifyFBX(asset);
+	}
+
+	// compare the fused palette build against inverting the bind pose per frame
+	if (BENCHMARK_SKINNING_PALETTE)
+		benchmark_skinning_palette();
+
 	//modelViewProjection = new ConstantBufferTransforms();
 
 	HRESULT hr = S_OK;
@@ -669,56 +708,76 @@ HRESULT InitContent()
 	//////////////////////////////////////////
 	//Create mesh render components
 	//////////////////////////////////////////
-	if (false) {
+	if (STATIC_MESH_ENABLED) {
 		Renderable meshRenderable;
 
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
 		// Load it!
-		//LoadFBX(".//Assets//cube.fbx", mesh, filename);
+		//LoadMeshCached(".//Assets//cube.fbx", PACKED_VERTEX_FORMAT, cache);
 		scale = 0.02f;
-		//		LoadFBX(".//Assets//Chest1-1.fbx", mesh, filename);
+		//		LoadMeshCached(".//Assets//Chest1-1.fbx", PACKED_VERTEX_FORMAT, cache);
 		scale = 0.01f;
-		//LoadFBX(".//Assets//raft_tris.fbx", mesh, filename);
-		//filename = "Texture_Raft.dds";
-		//LoadFBX(".//Assets//duck_tris.fbx", mesh, filename);
-		LoadFBX(".//Assets//rock01.fbx", mesh, filename);
+		//LoadMeshCached(".//Assets//raft_tris.fbx", PACKED_VERTEX_FORMAT, cache);
+		//LoadMeshCached(".//Assets//duck_tris.fbx", PACKED_VERTEX_FORMAT, cache);
+		// opaque static prop, sort its triangles to cut overdraw
+		// the baked .mesh holds the clusters and LOD chain as well, the FBX
+		// is only imported again when it or the importer changes
+		MeshCacheView cache;
+		optimizeOverdraw = true;
+		bool loaded = LoadMeshCached(".//Assets//rock01.fbx", PACKED_VERTEX_FORMAT, cache);
+		optimizeOverdraw = false;
+		if (!loaded)
+			return E_FAIL;
 
 		//LoadFBXAnimation(".//Assets//Run.fbx", mesh, filename, anim_clip);
 
-		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SimpleVertex),
-			mesh.vertexList.size());
-
-		// Load the Texture when texture filename is valid
+		// Load the Texture when texture filename is valid, rock01's albedo
+		// is not bundled so a missing texture falls back to plain white
+		std::string filename = cache.textureFilename;
 		if (filename != "")
 		{
 			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, ".//Assets//" + filename);
 			if (FAILED(hr))
-				return hr;
+			{
+				cout << filename << ": texture not found, drawing untextured" << endl;
+				meshRenderable.resourceView = texSRV;
+			}
 
 			// Create the sampler state
 			hr = meshRenderable.CreateDefaultSampler(g_pd3dDevice);
 		}
 
-		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
+		// Create the vertex buffers straight from the mapped cache
+		hr = meshRenderable.CreateBuffers(g_pd3dDevice, cache);
+
+		if (PACKED_VERTEX_FORMAT)
 		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
+			// 16 byte vertices, decoded in Packed_VS
+			D3D11_INPUT_ELEMENT_DESC packedLayout[] =
+			{
+				{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+				{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+				{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_UNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			};
+			hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Packed_VS.cso", packedLayout, ARRAYSIZE(packedLayout));
+
+			// the 24 byte PackedVertex24 layout for reference:
+			// { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			// { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			// { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		}
+		else
+		{
+			// Define the input layout
+			D3D11_INPUT_ELEMENT_DESC layout[] =
+			{
+				{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+				{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+				{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			};
+			hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
+		}
 
 		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
 		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
 
 		// Create the shader constant buffer
@@ -735,6 +794,37 @@ HRESULT InitContent()
 		//renderables.push_back(meshRenderable);
 	}
 
+	// Create multi mesh render components, every mesh and material of the
+	// file shares one vertex and index buffer and is drawn as a submesh
+	if (MULTI_MESH_ENABLED) {
+		Renderable sceneRenderable;
+		SimpleMesh<SimpleVertex> sceneMesh;
+		vector<MeshMaterial> materials;
+
+		scale = 0.01f;
+		LoadFBXMultiMesh(".//Assets//Rowing Boat-Tri.fbx", sceneMesh, sceneRenderable.subMeshes, materials);
+
+		// materials without a loadable texture keep the plain white one
+		hr = sceneRenderable.CreateMaterialTextures(g_pd3dDevice, materials, ".//Assets//");
+		sceneRenderable.resourceView = texSRV;
+		hr = sceneRenderable.CreateDefaultSampler(g_pd3dDevice);
+		hr = sceneRenderable.CreateBuffers(g_pd3dDevice, sceneMesh);
+
+		D3D11_INPUT_ELEMENT_DESC layout[] =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		};
+		hr = sceneRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
+		hr = sceneRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+
+		hr = sceneRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
+		hr = sceneRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
+		sceneRenderable.setPosition(0.0f, 0.0f, 5.0f);
+		renderables.push_back(sceneRenderable);
+	}
+
 	// Create grid render components
 	{
 		// Generate the geometry
@@ -774,22 +864,34 @@ HRESULT InitContent()
 		Renderable meshRenderable;
 
 		// Generate the geometry
-		SimpleMesh<SkinnedVertex> mesh;
+		SimpleMesh<SkinnedVertexCompact> mesh;
 
 		// filename for texture file
 		std::string filename;
 
 		// Load it!
 		scale = 1.00f; // must be 1.0f
-		LoadFBXAnimation(".//Assets//Run.fbx", mesh, filename, anim_clip);
+		JointPalettes palettes;
+		if (!LoadFBXAnimation(".//Assets//Run.fbx", mesh, filename, clip_library, &palettes))
+			return E_FAIL;
+		if (clip_library.clips.empty())
+		{
+			cout << "Run.fbx: no animation stacks to play" << endl;
+			return E_FAIL;
+		}
+		anim_clip = clip_library.clips.front();
+
+		// Drop the keys interpolation reproduces within tolerance
+		reduction_report_t reduction;
+		keyed_clip_t keyed_clip = reduce_clip(anim_clip, reduction_tolerance_t{}, &reduction);
+		print_reduction_report(reduction);
+
+		// Quantize the remaining keys, checked against the full clip
+		compressed_clip = compress_clip(keyed_clip);
+		print_compression_report(measure_compression(anim_clip, compressed_clip));
 
 		// Create the vertex buffers from the generated SimpleMesh
-		hr = meshRenderable.CreateBuffers(
-			g_pd3dDevice,
-			mesh.indicesList,
-			(float*)mesh.vertexList.data(),
-			sizeof(SkinnedVertex),
-			mesh.vertexList.size());
+		hr = meshRenderable.CreateBuffers(g_pd3dDevice, mesh);
 
 		// Load the Texture when texture filename is valid
 		if (filename != "")
@@ -808,8 +910,8 @@ HRESULT InitContent()
 			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "BLENDWEIGHTS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "BLENDINDICES", 0, DXGI_FORMAT_R32G32B32A32_SINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "BLENDWEIGHTS", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "BLENDINDICES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 		};
 
 		// Create the shaders
@@ -820,15 +922,8 @@ HRESULT InitContent()
 		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
 		hr = meshRenderable.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
 
-		D3D11_BUFFER_DESC mvp_bd;
-		ZeroMemory(&mvp_bd, sizeof(mvp_bd));
-
-		mvp_bd.Usage = D3D11_USAGE_DEFAULT;
-		mvp_bd.ByteWidth = sizeof(joint_deltas_t);
-		mvp_bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		mvp_bd.CPUAccessFlags = 0;
-
-		hr = g_pd3dDevice->CreateBuffer(&mvp_bd, NULL, &joint_deltas_CB);
+		// one palette buffer with a constant range per submesh palette
+		hr = meshRenderable.CreateJointPalettes(g_pd3dDevice, palettes, sizeof(skinning_matrix_t));
 
 		assert(!FAILED(hr));
 
@@ -864,7 +959,6 @@ void CleanupDevice()
 
 	if (pDSStateNoTest) pDSStateNoTest->Release();
 	if (vertex_buffer) vertex_buffer->Release();
-	if (joint_deltas_CB) joint_deltas_CB->Release();
 }
 
 
@@ -961,33 +1055,23 @@ void compute_global_delta_time(float time)
 	last_time = time;
 }
 
-void interpolate_transform(const float4x4& xform1, const float4x4& xform2, const float tween_ratio, float4x4& lerp_transform)
-{
-	XMVECTOR q1 = XMQuaternionRotationMatrix((const XMMATRIX&)xform1);
-	XMVECTOR q2 = XMQuaternionRotationMatrix((const XMMATRIX&)xform2);
-	XMVECTOR qt = XMQuaternionSlerp(q1, q2, tween_ratio);
-
-	lerp_transform = (float4x4&)XMMatrixRotationQuaternion(qt);
-	lerp_transform[3].xyz = xform1[3].xyz + (xform2[3].xyz - xform1[3].xyz) * tween_ratio;
-}
-
-void debug_render_skeleton(const joint_set_t& pose_joints, const float joint_scale)
+void debug_render_skeleton(const float4x4* transforms, const int* parents, int joint_count, const float joint_scale)
 {
-	for (int j = 1; j < pose_joints.size(); ++j)
+	for (int j = 1; j < joint_count; ++j)
 	{
-		int parent = pose_joints[j].parent;
+		int parent = parents[j];
 
 		debug_renderer::add_line(
-			pose_joints[j].transform[3].xyz * joint_scale,
-			pose_joints[parent].transform[3].xyz * joint_scale,
+			transforms[j][3].xyz * joint_scale,
+			transforms[parent][3].xyz * joint_scale,
 			{ 1.0f, 1.0f, 1.0f });
 	}
 
 	// draw joint markers
 	float marker_scale = 0.275;
-	for (int j = 0; j < pose_joints.size(); ++j)
+	for (int j = 0; j < joint_count; ++j)
 	{
-		float4x4 xform = pose_joints[j].transform;
+		float4x4 xform = transforms[j];
 		xform[0].xyz *= marker_scale;
 		xform[1].xyz *= marker_scale;
 		xform[2].xyz *= marker_scale;
@@ -1069,45 +1153,19 @@ void animate_character()
 	//	debug_render_skeleton(pose_joints, joint_scale);
 	//}
 
-	//// prepare the joint transforms amd copy for the skinning shader constant buffer
-	//for (int j = 0; j < pose_joints.size(); j++)
-	//{
-	//	XMMATRIX inv_bind = XMMatrixInverse(nullptr, (XMMATRIX&)anim_clip.keyframes.front().joints[j].transform);
-	//	XMMATRIX tween_joint = (XMMATRIX&)pose_joints[j].transform;
-
-	//	XMMATRIX joint_delta = XMMatrixMultiply(inv_bind, tween_joint);
-	//	joint_delta *= joint_scale;
-	//	joint_deltas.m[j] = XMMatrixTranspose(joint_delta);
-	//}
-
-	joint_set_t pose_joints;
-
-	// step thourgh each keyframe
-	static float anim_timer = anim_clip.keyframes[1].time;
-
-	// advance animation timer by delta time
-	anim_timer += delta_time *0.5f;
-
-	// if passed duration then reset
-	if (anim_timer > anim_clip.duration)
-	{
-		anim_timer -= anim_clip.duration;
-	}
-
-	const int joint_count = (int)(anim_clip.keyframes.front().joints.size());
-	pose_joints.resize(joint_count);
+	// advance the playback by delta time, wrapping at the end of the clip
+	character_playback.advance(delta_time, compressed_clip.duration);
 
-	int prev = (int)(anim_clip.keyframes.size() - 1);
-	int next = 1;
+	const int joint_count = compressed_clip.joint_count;
 
-	for (; next < anim_clip.keyframes.size(); prev = next++)
-	{
-		if (anim_timer < anim_clip.keyframes[next].time)
-			break;
-	}
+	// decode the compressed clip, then rebuild the model space pose
+	local_pose.resize(joint_count);
+	pose_transforms.resize(joint_count);
+	compressed_clip.sample(character_playback, local_pose.data(), decoded_pose);
+	local_to_global(local_pose.data(), compressed_clip.skeleton->parents.data(), joint_count, pose_transforms.data());
 
 	float joint_scale = 0.75f;
-	debug_render_skeleton(anim_clip.keyframes[prev].joints, joint_scale);
+	debug_render_skeleton(pose_transforms.data(), compressed_clip.skeleton->parents.data(), joint_count, joint_scale);
 
 }
 
@@ -1180,11 +1238,15 @@ void renderGrid()
 
 // Mesh render routine that supports toggling texturing
 // and toggling overlay wireframe
-void renderMesh(Renderable meshRenderable)
+void renderMesh(Renderable& meshRenderable)
 {
 	// copy transform to constant buffer
 	modelViewProjection.mWorld = XMMatrixTranspose(meshRenderable.world);
 
+	// pick the level of detail from the projected size of its error
+	if (LOD_SELECTION_ENABLED)
+		meshRenderable.SelectLod(g_View, g_Projection, g_ViewportHeight);
+
 	// send the constant buffers to the GPU
 	g_pImmediateContext->UpdateSubresource(meshRenderable.constantBufferVS.Get(), 0, nullptr, &modelViewProjection, 0, 0);
 	g_pImmediateContext->UpdateSubresource(meshRenderable.constantBufferPS.Get(), 0, nullptr, &lightsAndColor, 0, 0);
@@ -1213,7 +1275,10 @@ void renderMesh(Renderable meshRenderable)
 	}
 
 	// Bind and Draw the vertices
-	meshRenderable.Draw(g_pImmediateContext);
+	if (CLUSTER_CULLING_ENABLED)
+		meshRenderable.DrawClusters(g_pImmediateContext, g_View, g_Projection);
+	else
+		meshRenderable.Draw(g_pImmediateContext);
 
 	// redraw the whole mesh in wireframe mode
 	if (RENDER_STYLE_WIREFRAME)
@@ -1235,6 +1300,27 @@ void renderMesh(Renderable meshRenderable)
 	}
 }
 
+// Skinned mesh render routine, each submesh gets the palette of its joints
+// built straight into its range of the mapped palette buffer
+void renderSkinnedMesh(Renderable& meshRenderable)
+{
+	if (pose_transforms.empty())
+		return;
+
+	modelViewProjection.mWorld = XMMatrixTranspose(meshRenderable.world);
+	g_pImmediateContext->UpdateSubresource(meshRenderable.constantBufferVS.Get(), 0, nullptr, &modelViewProjection, 0, 0);
+	g_pImmediateContext->UpdateSubresource(meshRenderable.constantBufferPS.Get(), 0, nullptr, &lightsAndColor, 0, 0);
+
+	meshRenderable.Bind(g_pImmediateContext);
+
+	const float4x4* inverse_bind = compressed_clip.skeleton->inverse_bind_pose.data();
+	const float joint_scale = 0.75f;
+	meshRenderable.DrawSkinned(g_pImmediateContext, [&](const int* joints, int count, void* palette)
+	{
+		build_skinning_palette(inverse_bind, pose_transforms.data(), joints, count, joint_scale, (skinning_matrix_t*)palette);
+	});
+}
+
 void renderSkyBox()
 {
 	TransformsConstantBuffer cbDebug;
@@ -1294,7 +1380,7 @@ void Render()
 		g_pImmediateContext->OMSetDepthStencilState(pDSStateNoWrite, 1);
 
 	// Render all of the renderables in the scene
-	for (auto r : renderables)
+	for (auto& r : renderables)
 	{
 		renderMesh(r);
 		if (DEBUG_VIEW_ENABLED)
@@ -1302,9 +1388,7 @@ void Render()
 	}
 
 	// skinned mesh
-	g_pImmediateContext->UpdateSubresource(joint_deltas_CB, 0, NULL, &joint_deltas, 0, 0);
-	g_pImmediateContext->VSSetConstantBuffers(1, 1, &joint_deltas_CB);
-	//renderMesh(skinnedRenderable);
+	renderSkinnedMesh(skinnedRenderable);
 	if (DEBUG_VIEW_ENABLED)
 		end::debug_renderer::add_transform((end::float4x4&)skinnedRenderable.world);
 
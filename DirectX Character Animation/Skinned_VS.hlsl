@@ -16,11 +16,23 @@ cbuffer ConstantBufferTransforms : register(b0)
     matrix Projection;
 }
 
-cbuffer joint_deltas_t : register(b1)
+// Joints one draw can reference, must match MAX_PALETTE_JOINTS in MeshUtils.h.
+// Only the range of the submesh's palette is bound, see
+// Renderable::CreateJointPalettes, entries past it are never indexed.
+#define MAX_PALETTE_JOINTS 128
+
+// 3 rows per joint, the first three columns of its row vector transform
+// (skinning_matrix_t)
+cbuffer joint_palette_t : register(b1)
 {
-    matrix m[67];
+    float4 palette[MAX_PALETTE_JOINTS * 3];
 };
 
+float3 skin(float4 v, uint joint)
+{
+    return float3(dot(v, palette[joint * 3]), dot(v, palette[joint * 3 + 1]), dot(v, palette[joint * 3 + 2]));
+}
+
 
 //--------------------------------------------------------------------------------------
 struct VS_INPUT
@@ -28,8 +40,8 @@ struct VS_INPUT
     float4 pos : POSITION;
     float3 norm : NORMAL;
     float2 Tex : TEXCOORD0;
-    float4 weights : BLENDWEIGHTS;
-    int4 indices : BLENDINDICES;
+    float4 weights : BLENDWEIGHTS; // R8G8B8A8_UNORM, sums to 1
+    uint4 indices : BLENDINDICES;  // R8G8B8A8_UINT
 };
 
 struct PS_INPUT
@@ -46,18 +58,18 @@ struct PS_INPUT
 PS_INPUT VS(VS_INPUT input)
 {    
     PS_INPUT output;
-    bool skinning_on = false;
+    bool skinning_on = true;
     if (skinning_on)
     {
     // skinning VS shader
-    float4 skinned_pos = { 0.0f, 0.0f, 0.0f, 0.0f };
-    float4 skinned_norm = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float3 skinned_pos = { 0.0f, 0.0f, 0.0f };
+    float3 skinned_norm = { 0.0f, 0.0f, 0.0f };
 
 	[unroll]
     for (int j = 0; j < 4; j++)
     {
-        skinned_pos += mul(float4(input.pos.xyz, 1.0f), m[input.indices[j]]) * input.weights[j];
-        skinned_norm += mul(float4(input.norm.xyz, 0.0f), m[input.indices[j]]) * input.weights[j];
+        skinned_pos += skin(float4(input.pos.xyz, 1.0f), input.indices[j]) * input.weights[j];
+        skinned_norm += skin(float4(input.norm.xyz, 0.0f), input.indices[j]) * input.weights[j];
     }
     output.pos = mul(float4(skinned_pos.xyz, 1.0f), World);
     output.pos = mul(output.pos, View);
@@ -1,30 +1,400 @@
 #pragma once
 #include "math_types.h"
 #include <vector>
+#include <memory>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <string>
 
 namespace dev5
 {
 	using namespace end;
 
-	struct joint_t
+	// row vector convention, a is applied first
+	inline float4x4 multiply(const float4x4& a, const float4x4& b)
 	{
-		float4x4 transform;
-		int parent;
-	};
+		float4x4 result;
+		for (int r = 0; r < 4; ++r)
+			for (int c = 0; c < 4; ++c)
+				result[r][c] = a[r][0] * b[0][c] + a[r][1] * b[1][c] + a[r][2] * b[2][c] + a[r][3] * b[3][c];
+		return result;
+	}
+
+	// Rebuilds model space transforms from parent relative ones in a single
+	// pass, which needs every parent stored before its children (the breadth
+	// first order get_bindpose builds)
+	inline void local_to_global(const float4x4* local, const int* parents, int joint_count, float4x4* global)
+	{
+		for (int j = 0; j < joint_count; ++j)
+		{
+			int parent = parents[j];
+			assert(parent < j);
+			global[j] = parent < 0 ? local[j] : multiply(local[j], global[parent]);
+		}
+	}
+
+	// Inverse of an affine matrix (last column 0, 0, 0, 1)
+	inline float4x4 inverse_affine(const float4x4& m)
+	{
+		float3 r0 = m[0].xyz, r1 = m[1].xyz, r2 = m[2].xyz;
 
-	using joint_set_t = std::vector<joint_t>;
+		// the inverse of the 3x3 part is its adjugate over the determinant
+		float3 c0 = cross(r1, r2), c1 = cross(r2, r0), c2 = cross(r0, r1);
+		float inv_det = 1.0f / dot(r0, c0);
 
-	struct keyframe_t
+		float4x4 result;
+		result[0] = { c0.x * inv_det, c1.x * inv_det, c2.x * inv_det, 0.0f };
+		result[1] = { c0.y * inv_det, c1.y * inv_det, c2.y * inv_det, 0.0f };
+		result[2] = { c0.z * inv_det, c1.z * inv_det, c2.z * inv_det, 0.0f };
+
+		const float3& t = m[3].xyz;
+		for (int c = 0; c < 3; ++c)
+			result[3][c] = -(t.x * result[0][c] + t.y * result[1][c] + t.z * result[2][c]);
+		result[3].w = 1.0f;
+		return result;
+	}
+
+	// Joint hierarchy shared by every clip and instance of a character.
+	// Joints are ordered parents before children, bind_pose holds the model
+	// space joint transforms the mesh was skinned in and inverse_bind_pose
+	// their inverses, computed once when the skeleton is built.
+	struct skeleton_t
 	{
-		float time;
-		joint_set_t joints;
+		std::vector<std::string> names;
+		std::vector<int> parents;
+		std::vector<float4x4> bind_pose;
+		std::vector<float4x4> inverse_bind_pose;
+
+		int joint_count() const { return (int)parents.size(); }
+
+		// joint index by name, -1 when there is none
+		int find(const std::string& name) const
+		{
+			auto it = std::find(names.begin(), names.end(), name);
+			return it == names.end() ? -1 : (int)(it - names.begin());
+		}
+
+		void compute_inverse_bind_pose()
+		{
+			inverse_bind_pose.resize(bind_pose.size());
+			for (size_t j = 0; j < bind_pose.size(); ++j)
+				inverse_bind_pose[j] = inverse_affine(bind_pose[j]);
+		}
 	};
 
-	using keyframe_set_t = std::vector<keyframe_t>;
+	using skeleton_ptr = std::shared_ptr<const skeleton_t>;
 
+	// Flat clip, frame major: the joint transforms of frame f are
+	// frame(f)[0 .. joint_count). Transforms are relative to the parent
+	// joint of the skeleton, the root's is in model space, global_frame
+	// rebuilds the model space pose. The arrays are either owned by the
+	// clip or point into a baked clip file that the mapping keeps alive.
 	struct anim_clip_t
 	{
-		float duration;
-		keyframe_set_t keyframes;
+		float duration = 0.0f;
+		int frame_count = 0;
+		int joint_count = 0;
+		skeleton_ptr skeleton;
+
+		std::vector<float> time_storage;
+		std::vector<float4x4> transform_storage;
+
+		const float* mapped_times = nullptr;
+		const float4x4* mapped_transforms = nullptr;
+		std::shared_ptr<const void> mapping;
+
+		const float* times() const { return mapped_times ? mapped_times : time_storage.data(); }
+		const float4x4* transforms() const { return mapped_transforms ? mapped_transforms : transform_storage.data(); }
+
+		float time(int f) const { return times()[f]; }
+		const float4x4* frame(int f) const { return transforms() + (size_t)f * joint_count; }
+
+		void global_frame(int f, float4x4* global) const { local_to_global(frame(f), skeleton->parents.data(), joint_count, global); }
+	};
+
+	// Named clips of one character, all referencing its skeleton
+	struct clip_library_t
+	{
+		skeleton_ptr skeleton;
+		std::vector<std::string> names;
+		std::vector<anim_clip_t> clips;
+
+		// clip by name, nullptr when there is none
+		const anim_clip_t* find(const std::string& name) const
+		{
+			auto it = std::find(names.begin(), names.end(), name);
+			return it == names.end() ? nullptr : &clips[it - names.begin()];
+		}
+	};
+
+	// Rotation (unit quaternion), translation and scale of one joint
+	struct transform_t
+	{
+		float4 rotation;
+		float3 translation;
+		float3 scale;
+	};
+
+	inline float dot(const float4& a, const float4& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	}
+
+	inline float3 lerp(const float3& a, const float3& b, float t)
+	{
+		return a + (b - a) * t;
+	}
+
+	// normalized lerp along the shorter arc
+	inline float4 nlerp(const float4& a, const float4& b, float t)
+	{
+		float sign = dot(a, b) < 0.0f ? -1.0f : 1.0f;
+		float4 q;
+		for (int i = 0; i < 4; ++i)
+			q[i] = a[i] + (b[i] * sign - a[i]) * t;
+
+		float length = sqrtf(dot(q, q));
+		for (int i = 0; i < 4; ++i)
+			q[i] /= length;
+		return q;
+	}
+
+	// constant angular velocity interpolation along the shorter arc, falls
+	// back to nlerp when the rotations are too close for sin to be stable
+	inline float4 slerp(const float4& a, const float4& b, float t)
+	{
+		float d = dot(a, b);
+		float sign = d < 0.0f ? -1.0f : 1.0f;
+		d = fabsf(d);
+		if (d > 0.9999f)
+			return nlerp(a, b, t);
+
+		float angle = acosf(d);
+		float inv_sin = 1.0f / sinf(angle);
+		float wa = sinf((1.0f - t) * angle) * inv_sin;
+		float wb = sinf(t * angle) * inv_sin * sign;
+
+		float4 q;
+		for (int i = 0; i < 4; ++i)
+			q[i] = a[i] * wa + b[i] * wb;
+		return q;
+	}
+
+	// angle in radians between two unit quaternions
+	inline float rotation_angle(const float4& a, const float4& b)
+	{
+		return 2.0f * acosf(std::min(1.0f, fabsf(dot(a, b))));
+	}
+
+	// Same layout as XMMatrixAffineTransformation with a zero origin
+	inline float4x4 compose(const transform_t& t)
+	{
+		const float4& q = t.rotation;
+		float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+		float4x4 m;
+		m[0] = { (1.0f - 2.0f * (yy + zz)) * t.scale.x, 2.0f * (xy + wz) * t.scale.x, 2.0f * (xz - wy) * t.scale.x, 0.0f };
+		m[1] = { 2.0f * (xy - wz) * t.scale.y, (1.0f - 2.0f * (xx + zz)) * t.scale.y, 2.0f * (yz + wx) * t.scale.y, 0.0f };
+		m[2] = { 2.0f * (xz + wy) * t.scale.z, 2.0f * (yz - wx) * t.scale.z, (1.0f - 2.0f * (xx + yy)) * t.scale.z, 0.0f };
+		m[3] = { t.translation.x, t.translation.y, t.translation.z, 1.0f };
+		return m;
+	}
+
+	// Splits an affine matrix without shear into rotation, translation and
+	// scale, a mirrored matrix gets a negative x scale
+	inline transform_t decompose(const float4x4& m)
+	{
+		transform_t t;
+		t.translation = m[3].xyz;
+
+		float3 rows[3] = { m[0].xyz, m[1].xyz, m[2].xyz };
+		for (int r = 0; r < 3; ++r)
+		{
+			t.scale[r] = sqrtf(dot(rows[r], rows[r]));
+			if (t.scale[r] > 0.0f)
+				rows[r] /= t.scale[r];
+		}
+		if (dot(cross(rows[0], rows[1]), rows[2]) < 0.0f)
+		{
+			t.scale.x = -t.scale.x;
+			rows[0] *= -1.0f;
+		}
+
+		float trace = rows[0].x + rows[1].y + rows[2].z;
+		float4& q = t.rotation;
+		if (trace > 0.0f)
+		{
+			float s = sqrtf(trace + 1.0f) * 2.0f;
+			q = { (rows[1].z - rows[2].y) / s, (rows[2].x - rows[0].z) / s, (rows[0].y - rows[1].x) / s, 0.25f * s };
+		}
+		else if (rows[0].x > rows[1].y && rows[0].x > rows[2].z)
+		{
+			float s = sqrtf(1.0f + rows[0].x - rows[1].y - rows[2].z) * 2.0f;
+			q = { 0.25f * s, (rows[0].y + rows[1].x) / s, (rows[2].x + rows[0].z) / s, (rows[1].z - rows[2].y) / s };
+		}
+		else if (rows[1].y > rows[2].z)
+		{
+			float s = sqrtf(1.0f + rows[1].y - rows[0].x - rows[2].z) * 2.0f;
+			q = { (rows[0].y + rows[1].x) / s, 0.25f * s, (rows[1].z + rows[2].y) / s, (rows[2].x - rows[0].z) / s };
+		}
+		else
+		{
+			float s = sqrtf(1.0f + rows[2].z - rows[0].x - rows[1].y) * 2.0f;
+			q = { (rows[2].x + rows[0].z) / s, (rows[1].z + rows[2].y) / s, 0.25f * s, (rows[0].y - rows[1].x) / s };
+		}
+
+		float length = sqrtf(dot(q, q));
+		for (int i = 0; i < 4; ++i)
+			q[i] /= length;
+		return t;
+	}
+
+	// keys a cursor may step forward before find_key binary searches instead
+	const uint32_t CURSOR_MAX_STEPS = 4;
+
+	// Index of the key at or before t in times[begin, end) and the blend
+	// factor to the next key. cursor, when given, holds the key found last
+	// time for this track: during forward playback the answer is that key
+	// or one of the next few, so only seeks and loop wraps pay for the
+	// binary search.
+	template <typename Time>
+	int find_key(const Time* times, uint32_t begin, uint32_t end, float t, float& ratio, uint32_t* cursor = nullptr)
+	{
+		ratio = 0.0f;
+		uint32_t k;
+		if (end - begin == 1 || t <= times[begin])
+			k = begin;
+		else if (t >= times[end - 1])
+			k = end - 1;
+		else
+		{
+			// t is strictly inside the track, so key k + 1 always exists
+			k = cursor ? *cursor : begin;
+			bool cursor_valid = cursor && k >= begin && k + 1 < end && times[k] <= t;
+			for (uint32_t step = 0; cursor_valid && step < CURSOR_MAX_STEPS && times[k + 1] <= t; ++step)
+				++k;
+
+			if (!cursor_valid || times[k + 1] <= t)
+				k = (uint32_t)(std::upper_bound(times + begin, times + end, t) - times) - 1;
+
+			ratio = (t - times[k]) / (float)(times[k + 1] - times[k]);
+		}
+
+		if (cursor)
+			*cursor = k;
+		return (int)k;
+	}
+
+	// translation, rotation and scale
+	const int CLIP_CURSORS_PER_JOINT = 3;
+
+	// Playback state of one clip instance, so any number of instances can
+	// play the same (shared, read only) clip. The cursors remember the last
+	// key used on every track of the clip the instance plays.
+	struct clip_instance_t
+	{
+		float time = 0.0f;
+		float speed = 1.0f;
+		bool loop = true;
+		std::vector<uint32_t> cursors;
+
+		// Moves the playback time, wrapping or clamping at the clip end
+		void advance(float delta_time, float duration)
+		{
+			time += delta_time * speed;
+			if (loop && duration > 0.0f)
+			{
+				time = fmodf(time, duration);
+				if (time < 0.0f)
+					time += duration;
+			}
+			else
+				time = std::min(duration, std::max(0.0f, time));
+		}
+
+		// the cursors follow on their own, a jump only costs one binary search
+		void seek(float t) { time = t; }
+
+		uint32_t* joint_cursors(int joint_count)
+		{
+			cursors.resize((size_t)joint_count * CLIP_CURSORS_PER_JOINT, 0);
+			return cursors.data();
+		}
+	};
+
+	// Per joint key arrays of one channel: joint j has the keys
+	// [first[j], first[j + 1]) of times and values, a joint with a single
+	// key holds that value for the whole clip
+	template <typename T>
+	struct key_track_set_t
+	{
+		std::vector<uint32_t> first;
+		std::vector<float> times;
+		std::vector<T> values;
+
+		int key_count(int joint) const { return (int)(first[joint + 1] - first[joint]); }
+
+		size_t memory_size() const
+		{
+			return first.size() * sizeof(uint32_t) + times.size() * sizeof(float) + values.size() * sizeof(T);
+		}
+
+		// index of the key at or before t and the blend factor to the next key
+		int find(int joint, float t, float& ratio, uint32_t* cursor = nullptr) const
+		{
+			return find_key(times.data(), first[joint], first[joint + 1], t, ratio, cursor);
+		}
+	};
+
+	// Clip with separate key arrays per joint and channel, built from an
+	// anim_clip_t by reduce_clip (dev5_anim_reduce.h). Keys hold parent
+	// relative transforms, like anim_clip_t.
+	struct keyed_clip_t
+	{
+		float duration = 0.0f;
+		int joint_count = 0;
+		skeleton_ptr skeleton;
+
+		key_track_set_t<float3> translations;
+		key_track_set_t<float4> rotations;
+		key_track_set_t<float3> scales;
+
+		size_t memory_size() const
+		{
+			return translations.memory_size() + rotations.memory_size() + scales.memory_size();
+		}
+
+		// cursors, when given, are the joint's translation, rotation and
+		// scale cursors of a clip_instance_t
+		transform_t sample_joint(int joint, float t, uint32_t* cursors = nullptr) const
+		{
+			transform_t result;
+			float ratio;
+
+			int k = translations.find(joint, t, ratio, cursors ? &cursors[0] : nullptr);
+			result.translation = ratio > 0.0f ? lerp(translations.values[k], translations.values[k + 1], ratio) : translations.values[k];
+
+			k = rotations.find(joint, t, ratio, cursors ? &cursors[1] : nullptr);
+			result.rotation = ratio > 0.0f ? nlerp(rotations.values[k], rotations.values[k + 1], ratio) : rotations.values[k];
+
+			k = scales.find(joint, t, ratio, cursors ? &cursors[2] : nullptr);
+			result.scale = ratio > 0.0f ? lerp(scales.values[k], scales.values[k + 1], ratio) : scales.values[k];
+			return result;
+		}
+
+		// parent relative pose at time t, see local_to_global
+		void sample(float t, float4x4* local, uint32_t* cursors = nullptr) const
+		{
+			for (int j = 0; j < joint_count; ++j)
+				local[j] = compose(sample_joint(j, t, cursors ? cursors + j * CLIP_CURSORS_PER_JOINT : nullptr));
+		}
+
+		void sample(clip_instance_t& instance, float4x4* local) const
+		{
+			sample(instance.time, local, instance.joint_cursors(joint_count));
+		}
 	};
 }
\ No newline at end of file
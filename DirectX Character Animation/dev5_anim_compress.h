@@ -0,0 +1,356 @@
+#pragma once
+#include "dev5_anim_pose.h"
+#include <iostream>
+
+namespace dev5
+{
+	// Unit quaternion in 48 bits, smallest three: the largest component is
+	// dropped (and made positive), the other three are stored in order as
+	// 15 bit values in [-1/sqrt(2), 1/sqrt(2)]. Bit 15 of c[0] and c[1]
+	// hold the index of the dropped component.
+	struct packed_quat_t
+	{
+		uint16_t c[3];
+	};
+
+	// float3 as unorm16 against a quantize_range_t
+	struct packed_float3_t
+	{
+		uint16_t c[3];
+	};
+
+	// value = min + q / 65535 * extent
+	struct quantize_range_t
+	{
+		float3 min;
+		float3 extent;
+	};
+
+	const float SMALLEST_THREE_RANGE = 0.70710678f;
+
+	inline packed_quat_t pack_quat(float4 q)
+	{
+		int largest = 0;
+		for (int i = 1; i < 4; ++i)
+			if (fabsf(q[i]) > fabsf(q[largest]))
+				largest = i;
+
+		if (q[largest] < 0.0f)
+			for (int i = 0; i < 4; ++i)
+				q[i] = -q[i];
+
+		packed_quat_t packed;
+		for (int i = 0, c = 0; i < 4; ++i)
+		{
+			if (i == largest)
+				continue;
+			float v = (q[i] + SMALLEST_THREE_RANGE) / (2.0f * SMALLEST_THREE_RANGE);
+			packed.c[c++] = (uint16_t)std::min(32767.0f, std::max(0.0f, roundf(v * 32767.0f)));
+		}
+		packed.c[0] |= (uint16_t)((largest & 1) << 15);
+		packed.c[1] |= (uint16_t)((largest >> 1) << 15);
+		return packed;
+	}
+
+	// scalar reference for decode_quat4
+	inline float4 unpack_quat(const packed_quat_t& packed)
+	{
+		int largest = (packed.c[0] >> 15) | ((packed.c[1] >> 15) << 1);
+
+		float small[3];
+		float sum = 0.0f;
+		for (int c = 0; c < 3; ++c)
+		{
+			small[c] = (packed.c[c] & 0x7fff) * (2.0f * SMALLEST_THREE_RANGE / 32767.0f) - SMALLEST_THREE_RANGE;
+			sum += small[c] * small[c];
+		}
+
+		float4 q;
+		for (int i = 0, c = 0; i < 4; ++i)
+			q[i] = (i == largest) ? sqrtf(std::max(0.0f, 1.0f - sum)) : small[c++];
+		return q;
+	}
+
+	inline packed_float3_t pack_float3(const float3& v, const quantize_range_t& range)
+	{
+		packed_float3_t packed;
+		for (int i = 0; i < 3; ++i)
+		{
+			float n = range.extent[i] > 0.0f ? (v[i] - range.min[i]) / range.extent[i] : 0.0f;
+			packed.c[i] = (uint16_t)std::min(65535.0f, std::max(0.0f, roundf(n * 65535.0f)));
+		}
+		return packed;
+	}
+
+	inline float3 unpack_float3(const packed_float3_t& packed, const quantize_range_t& range)
+	{
+		float3 v;
+		for (int i = 0; i < 3; ++i)
+			v[i] = range.min[i] + packed.c[i] * (range.extent[i] / 65535.0f);
+		return v;
+	}
+
+	// Decodes four packed quaternions into SoA x, y, z, w
+	inline void decode_quat4(const packed_quat_t* const packed[4], __m128 out[4])
+	{
+		alignas(16) int32_t c[3][4];
+		for (int lane = 0; lane < 4; ++lane)
+			for (int i = 0; i < 3; ++i)
+				c[i][lane] = packed[lane]->c[i];
+
+		__m128i c0 = _mm_load_si128((const __m128i*)c[0]);
+		__m128i c1 = _mm_load_si128((const __m128i*)c[1]);
+		__m128i c2 = _mm_load_si128((const __m128i*)c[2]);
+
+		__m128i largest = _mm_or_si128(_mm_srli_epi32(c0, 15), _mm_slli_epi32(_mm_srli_epi32(c1, 15), 1));
+
+		const __m128i value_mask = _mm_set1_epi32(0x7fff);
+		const __m128 scale = _mm_set1_ps(2.0f * SMALLEST_THREE_RANGE / 32767.0f);
+		const __m128 bias = _mm_set1_ps(SMALLEST_THREE_RANGE);
+		__m128 a = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(c0, value_mask)), scale), bias);
+		__m128 b = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(c1, value_mask)), scale), bias);
+		__m128 d = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(c2, value_mask)), scale), bias);
+
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(d, d));
+		__m128 big = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1.0f), sum)));
+
+		__m128 is0 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(0)));
+		__m128 is1 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(1)));
+		__m128 is2 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(2)));
+		__m128 is3 = _mm_castsi128_ps(_mm_cmpeq_epi32(largest, _mm_set1_epi32(3)));
+
+		out[0] = select4(is0, big, a);
+		out[1] = select4(is0, a, select4(is1, big, b));
+		out[2] = select4(_mm_or_ps(is0, is1), b, select4(is2, big, d));
+		out[3] = select4(is3, big, d);
+	}
+
+	// Per joint key arrays like key_track_set_t, with key times as unorm16
+	// of the clip duration
+	template <typename T>
+	struct packed_track_set_t
+	{
+		std::vector<uint32_t> first;
+		std::vector<uint16_t> times;
+		std::vector<T> values;
+
+		size_t memory_size() const
+		{
+			return first.size() * sizeof(uint32_t) + times.size() * sizeof(uint16_t) + values.size() * sizeof(T);
+		}
+
+		// t is in unorm16 units of the duration, see key_track_set_t::find
+		int find(int joint, float t, float& ratio, uint32_t* cursor = nullptr) const
+		{
+			return find_key(times.data(), first[joint], first[joint + 1], t, ratio, cursor);
+		}
+	};
+
+	// keyed_clip_t with 48 bit rotations and 48 bit translations and
+	// scales quantized against per joint ranges of the clip
+	struct compressed_clip_t
+	{
+		float duration = 0.0f;
+		int joint_count = 0;
+		skeleton_ptr skeleton;
+
+		packed_track_set_t<packed_float3_t> translations;
+		packed_track_set_t<packed_quat_t> rotations;
+		packed_track_set_t<packed_float3_t> scales;
+		std::vector<quantize_range_t> translation_ranges;
+		std::vector<quantize_range_t> scale_ranges;
+
+		size_t memory_size() const
+		{
+			return translations.memory_size() + rotations.memory_size() + scales.memory_size() +
+				(translation_ranges.size() + scale_ranges.size()) * sizeof(quantize_range_t);
+		}
+
+		float3 sample_float3(const packed_track_set_t<packed_float3_t>& track, const quantize_range_t& range, int joint, float key_time, uint32_t* cursor) const
+		{
+			float ratio;
+			int k = track.find(joint, key_time, ratio, cursor);
+			int next = ratio > 0.0f ? k + 1 : k;
+
+			const uint16_t* a = track.values[k].c;
+			const uint16_t* b = track.values[next].c;
+			__m128 qa = _mm_cvtepi32_ps(_mm_setr_epi32(a[0], a[1], a[2], 0));
+			__m128 qb = _mm_cvtepi32_ps(_mm_setr_epi32(b[0], b[1], b[2], 0));
+			__m128 q = _mm_add_ps(qa, _mm_mul_ps(_mm_sub_ps(qb, qa), _mm_set1_ps(ratio)));
+
+			__m128 min = _mm_setr_ps(range.min.x, range.min.y, range.min.z, 0.0f);
+			__m128 step = _mm_mul_ps(_mm_setr_ps(range.extent.x, range.extent.y, range.extent.z, 0.0f), _mm_set1_ps(1.0f / 65535.0f));
+
+			alignas(16) float v[4];
+			_mm_store_ps(v, _mm_add_ps(min, _mm_mul_ps(q, step)));
+			return { v[0], v[1], v[2] };
+		}
+
+		// Decodes the pose at time t. Rotations are decoded and blended four
+		// joints at a time straight into the pose streams, translations and
+		// scales one joint per vector. cursors, when given, are the track
+		// cursors of a clip_instance_t.
+		void sample(float t, pose_t& pose, uint32_t* cursors = nullptr) const
+		{
+			auto cursor = [&](int joint, int channel) { return cursors ? &cursors[joint * CLIP_CURSORS_PER_JOINT + channel] : nullptr; };
+
+			pose.resize(joint_count);
+			float key_time = std::min(1.0f, std::max(0.0f, t / duration)) * 65535.0f;
+
+			for (int j0 = 0; j0 < joint_count; j0 += 4)
+			{
+				const packed_quat_t* a[4];
+				const packed_quat_t* b[4];
+				alignas(16) float ratios[4];
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					// the last group repeats its last joint into the padding
+					int j = std::min(j0 + lane, joint_count - 1);
+					int k = rotations.find(j, key_time, ratios[lane], cursor(j, 1));
+					a[lane] = &rotations.values[k];
+					b[lane] = &rotations.values[ratios[lane] > 0.0f ? k + 1 : k];
+				}
+
+				__m128 qa[4], qb[4], q[4];
+				decode_quat4(a, qa);
+				decode_quat4(b, qb);
+				nlerp4(qa, qb, _mm_load_ps(ratios), q);
+
+				for (int i = 0; i < 4; ++i)
+					_mm_storeu_ps(pose.channel(pose_t::ROTATION_X + i) + j0, q[i]);
+			}
+
+			for (int j = 0; j < joint_count; ++j)
+			{
+				float3 translation = sample_float3(translations, translation_ranges[j], j, key_time, cursor(j, 0));
+				float3 scale = sample_float3(scales, scale_ranges[j], j, key_time, cursor(j, 2));
+				for (int i = 0; i < 3; ++i)
+				{
+					pose.channel(pose_t::TRANSLATION_X + i)[j] = translation[i];
+					pose.channel(pose_t::SCALE_X + i)[j] = scale[i];
+				}
+			}
+		}
+
+		void sample(clip_instance_t& instance, pose_t& pose) const
+		{
+			sample(instance.time, pose, instance.joint_cursors(joint_count));
+		}
+
+		// parent relative pose of an instance, see local_to_global
+		void sample(clip_instance_t& instance, float4x4* local, pose_t& scratch) const
+		{
+			sample(instance, scratch);
+			compose(scratch, local);
+		}
+	};
+
+	template <typename T>
+	quantize_range_t track_range(const key_track_set_t<T>& track, int joint)
+	{
+		quantize_range_t range;
+		float3 max = track.values[track.first[joint]];
+		range.min = max;
+		for (uint32_t k = track.first[joint]; k < track.first[joint + 1]; ++k)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				range.min[i] = std::min(range.min[i], track.values[k][i]);
+				max[i] = std::max(max[i], track.values[k][i]);
+			}
+		}
+		range.extent = max - range.min;
+		return range;
+	}
+
+	template <typename T, typename P, typename Pack>
+	void pack_track(const key_track_set_t<T>& track, float duration, packed_track_set_t<P>& packed, Pack pack)
+	{
+		packed.first = track.first;
+		packed.times.resize(track.times.size());
+		packed.values.resize(track.values.size());
+		for (size_t k = 0; k < track.times.size(); ++k)
+		{
+			float n = duration > 0.0f ? track.times[k] / duration : 0.0f;
+			packed.times[k] = (uint16_t)std::min(65535.0f, std::max(0.0f, roundf(n * 65535.0f)));
+			packed.values[k] = pack(track.values[k], k);
+		}
+	}
+
+	inline compressed_clip_t compress_clip(const keyed_clip_t& clip)
+	{
+		compressed_clip_t result;
+		result.duration = clip.duration;
+		result.joint_count = clip.joint_count;
+		result.skeleton = clip.skeleton;
+
+		for (int j = 0; j < clip.joint_count; ++j)
+		{
+			result.translation_ranges.push_back(track_range(clip.translations, j));
+			result.scale_ranges.push_back(track_range(clip.scales, j));
+		}
+
+		// the range of the joint owning key k
+		auto joint_of = [&](const std::vector<uint32_t>& first, size_t k)
+		{
+			return (int)(std::upper_bound(first.begin(), first.end(), (uint32_t)k) - first.begin()) - 1;
+		};
+
+		pack_track(clip.translations, clip.duration, result.translations, [&](const float3& v, size_t k)
+		{
+			return pack_float3(v, result.translation_ranges[joint_of(clip.translations.first, k)]);
+		});
+		pack_track(clip.rotations, clip.duration, result.rotations, [](const float4& q, size_t)
+		{
+			return pack_quat(q);
+		});
+		pack_track(clip.scales, clip.duration, result.scales, [&](const float3& v, size_t k)
+		{
+			return pack_float3(v, result.scale_ranges[joint_of(clip.scales.first, k)]);
+		});
+
+		return result;
+	}
+
+	struct compression_report_t
+	{
+		size_t source_bytes = 0;
+		size_t compressed_bytes = 0;
+		float max_translation_error = 0.0f;
+		float max_rotation_error = 0.0f;
+		float max_scale_error = 0.0f;
+	};
+
+	// Compares the compressed clip against the uncompressed one at every
+	// source frame
+	inline compression_report_t measure_compression(const anim_clip_t& source, const compressed_clip_t& compressed)
+	{
+		compression_report_t report;
+		report.source_bytes = (size_t)source.frame_count * (sizeof(float) + source.joint_count * sizeof(float4x4));
+		report.compressed_bytes = compressed.memory_size();
+
+		pose_t pose;
+		for (int f = 0; f < source.frame_count; ++f)
+		{
+			compressed.sample(source.time(f), pose);
+			for (int j = 0; j < source.joint_count; ++j)
+			{
+				transform_t t = decompose(source.frame(f)[j]);
+				transform_t c = pose.get(j);
+				float3 dt = t.translation - c.translation;
+				float3 ds = abs(t.scale - c.scale);
+				report.max_translation_error = std::max(report.max_translation_error, sqrtf(dot(dt, dt)));
+				report.max_rotation_error = std::max(report.max_rotation_error, rotation_angle(t.rotation, c.rotation));
+				report.max_scale_error = std::max(report.max_scale_error, std::max(ds.x, std::max(ds.y, ds.z)));
+			}
+		}
+		return report;
+	}
+
+	inline void print_compression_report(const compression_report_t& r)
+	{
+		std::cout << "Clip compression: " << r.source_bytes / 1024 << " KB -> " << r.compressed_bytes / 1024 << " KB ("
+			<< (float)r.source_bytes / r.compressed_bytes << "x), max error "
+			<< r.max_translation_error << " / " << r.max_rotation_error << " rad / " << r.max_scale_error << std::endl;
+	}
+}
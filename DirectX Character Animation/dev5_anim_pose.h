@@ -0,0 +1,214 @@
+#pragma once
+#include "dev5_anim.h"
+#include <emmintrin.h>
+
+namespace dev5
+{
+	inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	inline __m128 dot4(const __m128 a[4], const __m128 b[4])
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+			_mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+	}
+
+	inline __m128 lerp4(__m128 a, __m128 b, __m128 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	// nlerp of four SoA quaternion pairs along the shorter arc
+	inline void nlerp4(const __m128 a[4], const __m128 b[4], __m128 t, __m128 out[4])
+	{
+		__m128 sign = _mm_and_ps(_mm_cmplt_ps(dot4(a, b), _mm_setzero_ps()), _mm_set1_ps(-0.0f));
+
+		__m128 length_sq = _mm_setzero_ps();
+		for (int i = 0; i < 4; ++i)
+		{
+			out[i] = lerp4(a[i], _mm_xor_ps(b[i], sign), t);
+			length_sq = _mm_add_ps(length_sq, _mm_mul_ps(out[i], out[i]));
+		}
+
+		__m128 inv_length = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length_sq));
+		for (int i = 0; i < 4; ++i)
+			out[i] = _mm_mul_ps(out[i], inv_length);
+	}
+
+	// Rotations further apart than this cosine (about 36 degrees) are
+	// slerped by blend_poses when asked to, nlerp's speed error below it is
+	// under half a percent
+	const float NLERP_MIN_COS = 0.95f;
+
+	// Pose of a whole skeleton as one stream per channel, so kernels work on
+	// four joints per vector. Streams are padded to a multiple of four joints
+	// with identity transforms.
+	struct pose_t
+	{
+		enum channel_t
+		{
+			ROTATION_X, ROTATION_Y, ROTATION_Z, ROTATION_W,
+			TRANSLATION_X, TRANSLATION_Y, TRANSLATION_Z,
+			SCALE_X, SCALE_Y, SCALE_Z,
+			CHANNEL_COUNT
+		};
+
+		int joint_count = 0;
+		int stride = 0;
+		std::vector<float> streams;
+
+		void resize(int count)
+		{
+			if (count == joint_count)
+				return;
+
+			joint_count = count;
+			stride = (count + 3) & ~3;
+			streams.assign((size_t)stride * CHANNEL_COUNT, 0.0f);
+			for (int c : { ROTATION_W, SCALE_X, SCALE_Y, SCALE_Z })
+				std::fill_n(channel(c), stride, 1.0f);
+		}
+
+		float* channel(int c) { return streams.data() + (size_t)c * stride; }
+		const float* channel(int c) const { return streams.data() + (size_t)c * stride; }
+
+		transform_t get(int joint) const
+		{
+			transform_t t;
+			for (int i = 0; i < 4; ++i)
+				t.rotation[i] = channel(ROTATION_X + i)[joint];
+			for (int i = 0; i < 3; ++i)
+			{
+				t.translation[i] = channel(TRANSLATION_X + i)[joint];
+				t.scale[i] = channel(SCALE_X + i)[joint];
+			}
+			return t;
+		}
+
+		void set(int joint, const transform_t& t)
+		{
+			for (int i = 0; i < 4; ++i)
+				channel(ROTATION_X + i)[joint] = t.rotation[i];
+			for (int i = 0; i < 3; ++i)
+			{
+				channel(TRANSLATION_X + i)[joint] = t.translation[i];
+				channel(SCALE_X + i)[joint] = t.scale[i];
+			}
+		}
+	};
+
+	// out = a blended towards b by weight, four joints per iteration.
+	// Rotations are nlerped; with use_slerp the lanes whose rotations are
+	// further apart than NLERP_MIN_COS are redone with slerp. out may alias
+	// a or b.
+	inline void blend_poses(const pose_t& a, const pose_t& b, float weight, pose_t& out, bool use_slerp = false)
+	{
+		assert(a.joint_count == b.joint_count);
+		out.resize(a.joint_count);
+
+		const __m128 t = _mm_set1_ps(weight);
+		const __m128 min_cos = _mm_set1_ps(NLERP_MIN_COS);
+		const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		for (int j = 0; j < a.stride; j += 4)
+		{
+			__m128 qa[4], qb[4], q[4];
+			for (int i = 0; i < 4; ++i)
+			{
+				qa[i] = _mm_loadu_ps(a.channel(pose_t::ROTATION_X + i) + j);
+				qb[i] = _mm_loadu_ps(b.channel(pose_t::ROTATION_X + i) + j);
+			}
+			nlerp4(qa, qb, t, q);
+
+			int far_lanes = use_slerp ? _mm_movemask_ps(_mm_cmplt_ps(_mm_and_ps(dot4(qa, qb), abs_mask), min_cos)) : 0;
+			if (far_lanes)
+			{
+				alignas(16) float soa[2][4][4];
+				for (int i = 0; i < 4; ++i)
+				{
+					_mm_store_ps(soa[0][i], qa[i]);
+					_mm_store_ps(soa[1][i], qb[i]);
+				}
+				alignas(16) float result[4][4];
+				for (int i = 0; i < 4; ++i)
+					_mm_store_ps(result[i], q[i]);
+
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					if (!(far_lanes & (1 << lane)))
+						continue;
+					float4 s = slerp({ soa[0][0][lane], soa[0][1][lane], soa[0][2][lane], soa[0][3][lane] },
+						{ soa[1][0][lane], soa[1][1][lane], soa[1][2][lane], soa[1][3][lane] }, weight);
+					for (int i = 0; i < 4; ++i)
+						result[i][lane] = s[i];
+				}
+				for (int i = 0; i < 4; ++i)
+					q[i] = _mm_load_ps(result[i]);
+			}
+
+			for (int i = 0; i < 4; ++i)
+				_mm_storeu_ps(out.channel(pose_t::ROTATION_X + i) + j, q[i]);
+
+			for (int c = pose_t::TRANSLATION_X; c < pose_t::CHANNEL_COUNT; ++c)
+			{
+				__m128 va = _mm_loadu_ps(a.channel(c) + j);
+				__m128 vb = _mm_loadu_ps(b.channel(c) + j);
+				_mm_storeu_ps(out.channel(c) + j, lerp4(va, vb, t));
+			}
+		}
+	}
+
+	// Builds the matrix of every joint, see compose(const transform_t&).
+	// Each group of four joints is computed as SoA and transposed into rows.
+	inline void compose(const pose_t& pose, float4x4* out)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 zero = _mm_setzero_ps();
+
+		for (int j0 = 0; j0 < pose.joint_count; j0 += 4)
+		{
+			auto load = [&](int c) { return _mm_loadu_ps(pose.channel(c) + j0); };
+			__m128 x = load(pose_t::ROTATION_X), y = load(pose_t::ROTATION_Y);
+			__m128 z = load(pose_t::ROTATION_Z), w = load(pose_t::ROTATION_W);
+			__m128 sx = load(pose_t::SCALE_X), sy = load(pose_t::SCALE_Y), sz = load(pose_t::SCALE_Z);
+
+			__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+			__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+			__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+			__m128 rows[4][4] =
+			{
+				{
+					_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+					zero
+				},
+				{
+					_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+					_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+					zero
+				},
+				{
+					_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+					_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+					_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+					zero
+				},
+				{ load(pose_t::TRANSLATION_X), load(pose_t::TRANSLATION_Y), load(pose_t::TRANSLATION_Z), one }
+			};
+
+			// rows[r] now holds row r of joints j0..j0+3 in its four lanes
+			for (int r = 0; r < 4; ++r)
+				_MM_TRANSPOSE4_PS(rows[r][0], rows[r][1], rows[r][2], rows[r][3]);
+
+			for (int lane = 0; lane < 4 && j0 + lane < pose.joint_count; ++lane)
+				for (int r = 0; r < 4; ++r)
+					_mm_storeu_ps(&out[j0 + lane][r].x, rows[r][lane]);
+		}
+	}
+}
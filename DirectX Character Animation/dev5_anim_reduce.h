@@ -0,0 +1,164 @@
+#pragma once
+#include "dev5_anim.h"
+#include <iostream>
+
+namespace dev5
+{
+	// Largest reconstruction error a removed key may cause, per channel.
+	// Translation is in model units, rotation in radians, scale is absolute.
+	struct reduction_tolerance_t
+	{
+		float translation = 0.001f;
+		float rotation = 0.001f;
+		float scale = 0.001f;
+	};
+
+	struct reduction_report_t
+	{
+		int source_keys = 0;	// frames * joints, per channel
+		int translation_keys = 0;
+		int rotation_keys = 0;
+		int scale_keys = 0;
+		size_t source_bytes = 0;
+		size_t reduced_bytes = 0;
+		// measured by sampling the reduced clip at every source frame
+		float max_translation_error = 0.0f;
+		float max_rotation_error = 0.0f;
+		float max_scale_error = 0.0f;
+	};
+
+	inline float translation_error(const float3& a, const float3& b)
+	{
+		float3 d = a - b;
+		return sqrtf(dot(d, d));
+	}
+
+	inline float scale_error(const float3& a, const float3& b)
+	{
+		float3 d = abs(a - b);
+		return std::max(d.x, std::max(d.y, d.z));
+	}
+
+	// Greedy key removal on one channel of one joint: each key is followed
+	// by the furthest key whose interpolation reproduces every frame in
+	// between within tolerance. A channel that never leaves tolerance of
+	// its first value keeps that single key.
+	template <typename T, typename Interpolate, typename Error>
+	void reduce_track(const float* times, const T* values, int count, float tolerance,
+		Interpolate interpolate, Error error, key_track_set_t<T>& track)
+	{
+		auto fits = [&](int a, int b)
+		{
+			for (int i = a + 1; i < b; ++i)
+			{
+				float ratio = (times[i] - times[a]) / (times[b] - times[a]);
+				if (error(interpolate(values[a], values[b], ratio), values[i]) > tolerance)
+					return false;
+			}
+			return true;
+		};
+
+		track.times.push_back(times[0]);
+		track.values.push_back(values[0]);
+
+		bool constant = true;
+		for (int i = 1; i < count && constant; ++i)
+			constant = error(values[0], values[i]) <= tolerance;
+
+		if (!constant)
+		{
+			int a = 0;
+			while (a < count - 1)
+			{
+				int b = a + 1;
+				while (b + 1 < count && fits(a, b + 1))
+					++b;
+
+				track.times.push_back(times[b]);
+				track.values.push_back(values[b]);
+				a = b;
+			}
+		}
+
+		track.first.push_back((uint32_t)track.times.size());
+	}
+
+	// Offline pass turning a fully sampled clip into per joint, per channel
+	// key arrays, dropping every key that interpolation from its neighbours
+	// reproduces within tolerance
+	inline keyed_clip_t reduce_clip(const anim_clip_t& clip, const reduction_tolerance_t& tolerance = {}, reduction_report_t* report = nullptr)
+	{
+		keyed_clip_t result;
+		result.duration = clip.duration;
+		result.joint_count = clip.joint_count;
+		result.skeleton = clip.skeleton;
+
+		const int frame_count = clip.frame_count;
+		const int joint_count = clip.joint_count;
+
+		result.translations.first.push_back(0);
+		result.rotations.first.push_back(0);
+		result.scales.first.push_back(0);
+
+		std::vector<float3> translations(frame_count);
+		std::vector<float4> rotations(frame_count);
+		std::vector<float3> scales(frame_count);
+
+		for (int j = 0; j < joint_count; ++j)
+		{
+			for (int f = 0; f < frame_count; ++f)
+			{
+				transform_t t = decompose(clip.frame(f)[j]);
+				translations[f] = t.translation;
+				scales[f] = t.scale;
+
+				// keep neighbouring quaternions on the same hemisphere
+				rotations[f] = t.rotation;
+				if (f > 0 && dot(rotations[f - 1], rotations[f]) < 0.0f)
+					for (int i = 0; i < 4; ++i)
+						rotations[f][i] = -rotations[f][i];
+			}
+
+			reduce_track(clip.times(), translations.data(), frame_count, tolerance.translation,
+				lerp, translation_error, result.translations);
+			reduce_track(clip.times(), rotations.data(), frame_count, tolerance.rotation,
+				nlerp, rotation_angle, result.rotations);
+			reduce_track(clip.times(), scales.data(), frame_count, tolerance.scale,
+				lerp, scale_error, result.scales);
+		}
+
+		if (report)
+		{
+			reduction_report_t& r = *report;
+			r = {};
+			r.source_keys = frame_count * joint_count;
+			r.translation_keys = (int)result.translations.values.size();
+			r.rotation_keys = (int)result.rotations.values.size();
+			r.scale_keys = (int)result.scales.values.size();
+			r.source_bytes = (size_t)frame_count * (sizeof(float) + joint_count * sizeof(float4x4));
+			r.reduced_bytes = result.memory_size();
+
+			for (int f = 0; f < frame_count; ++f)
+			{
+				for (int j = 0; j < joint_count; ++j)
+				{
+					transform_t source = decompose(clip.frame(f)[j]);
+					transform_t reduced = result.sample_joint(j, clip.time(f));
+					r.max_translation_error = std::max(r.max_translation_error, translation_error(source.translation, reduced.translation));
+					r.max_rotation_error = std::max(r.max_rotation_error, rotation_angle(source.rotation, reduced.rotation));
+					r.max_scale_error = std::max(r.max_scale_error, scale_error(source.scale, reduced.scale));
+				}
+			}
+		}
+
+		return result;
+	}
+
+	inline void print_reduction_report(const reduction_report_t& r)
+	{
+		std::cout << "Keyframe reduction: " << r.source_keys << " keys per channel, kept "
+			<< r.translation_keys << " translation, " << r.rotation_keys << " rotation, " << r.scale_keys << " scale, "
+			<< r.source_bytes / 1024 << " KB -> " << r.reduced_bytes / 1024 << " KB, max error "
+			<< r.max_translation_error << " / " << r.max_rotation_error << " rad / " << r.max_scale_error << std::endl;
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "dev5_anim.h"
+#include <emmintrin.h>
+#include <chrono>
+#include <iostream>
+
+namespace dev5
+{
+	// Palette entry of one joint: the first three columns of its row vector
+	// transform, stored as rows, so a point is skinned with three dot
+	// products and the constant column 0, 0, 0, 1 is not uploaded
+	struct skinning_matrix_t
+	{
+		float4 rows[3];
+	};
+
+	static_assert(sizeof(skinning_matrix_t) == 48, "skinning_matrix_t must be 48 bytes");
+
+	// Fills a skinning palette of a pose: entry i maps bind pose model space
+	// to posed model space for joint j = joints[i] (i when joints is null),
+	// inverse_bind[j] * global[j] scaled by scale. One pass reads each input
+	// once and writes each output row once, in order, so out can be mapped
+	// constant buffer memory.
+	inline void build_skinning_palette(const float4x4* inverse_bind, const float4x4* global, const int* joints, int count, float scale, skinning_matrix_t* out)
+	{
+		const __m128 scale_xyz = _mm_setr_ps(scale, scale, scale, 1.0f);
+
+		for (int i = 0; i < count; ++i)
+		{
+			int j = joints ? joints[i] : i;
+			const float* g = &global[j][0].x;
+			__m128 g0 = _mm_loadu_ps(g);
+			__m128 g1 = _mm_loadu_ps(g + 4);
+			__m128 g2 = _mm_loadu_ps(g + 8);
+			__m128 g3 = _mm_loadu_ps(g + 12);
+
+			__m128 rows[4];
+			for (int r = 0; r < 4; ++r)
+			{
+				const float4& b = inverse_bind[j][r];
+				__m128 row = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(b.x), g0), _mm_mul_ps(_mm_set1_ps(b.y), g1)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(b.z), g2), _mm_mul_ps(_mm_set1_ps(b.w), g3)));
+				rows[r] = _mm_mul_ps(row, scale_xyz);
+			}
+
+			// the fourth column, 0, 0, 0, 1, ends up in rows[3] and is dropped
+			_MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+
+			float* o = &out[i].rows[0].x;
+			_mm_storeu_ps(o, rows[0]);
+			_mm_storeu_ps(o + 4, rows[1]);
+			_mm_storeu_ps(o + 8, rows[2]);
+		}
+	}
+
+	// Scalar reference for build_skinning_palette that inverts the bind pose
+	// every call, the way the palette used to be built
+	inline void build_skinning_palette_reference(const float4x4* bind, const float4x4* global, int joint_count, float scale, skinning_matrix_t* out)
+	{
+		for (int j = 0; j < joint_count; ++j)
+		{
+			float4x4 delta = multiply(inverse_affine(bind[j]), global[j]);
+			for (int r = 0; r < 4; ++r)
+				for (int c = 0; c < 3; ++c)
+					out[j].rows[c][r] = delta[r][c] * scale;
+		}
+	}
+
+	// Times both palette builds for a range of skeleton sizes and checks
+	// they agree
+	inline bool benchmark_skinning_palette()
+	{
+		using clock = std::chrono::high_resolution_clock;
+		const int joint_counts[] = { 20, 67, 128, 256 };
+		const int iterations = 10000;
+
+		bool match = true;
+		std::cout << "\n[Skinning palette benchmark] ns per palette, " << iterations << " builds" << std::endl;
+		for (int joint_count : joint_counts)
+		{
+			std::vector<float4x4> bind(joint_count), inverse_bind(joint_count), global(joint_count);
+			std::vector<skinning_matrix_t> reference(joint_count), fused(joint_count);
+			for (int j = 0; j < joint_count; ++j)
+			{
+				float angle = 0.1f * j;
+				transform_t t;
+				t.rotation = { 0.0f, sinf(angle), 0.0f, cosf(angle) };
+				t.translation = { 0.0f, 1.0f * j, 0.5f * j };
+				t.scale = { 1.0f, 1.0f, 1.0f };
+				bind[j] = compose(t);
+				t.rotation = { sinf(angle), 0.0f, 0.0f, cosf(angle) };
+				global[j] = compose(t);
+				inverse_bind[j] = inverse_affine(bind[j]);
+			}
+
+			auto start = clock::now();
+			for (int i = 0; i < iterations; ++i)
+				build_skinning_palette_reference(bind.data(), global.data(), joint_count, 0.75f, reference.data());
+			double reference_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations;
+
+			start = clock::now();
+			for (int i = 0; i < iterations; ++i)
+				build_skinning_palette(inverse_bind.data(), global.data(), nullptr, joint_count, 0.75f, fused.data());
+			double fused_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations;
+
+			float max_error = 0.0f;
+			for (int j = 0; j < joint_count; ++j)
+				for (int r = 0; r < 3; ++r)
+					for (int c = 0; c < 4; ++c)
+						max_error = std::max(max_error, fabsf(reference[j].rows[r][c] - fused[j].rows[r][c]));
+			match = match && max_error < 1e-3f;
+
+			std::cout << joint_count << " joints: reference " << reference_ns << " ns  fused " << fused_ns
+				<< " ns  speedup " << reference_ns / fused_ns << "x  max error " << max_error << std::endl;
+		}
+		return match;
+	}
+}
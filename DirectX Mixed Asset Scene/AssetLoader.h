@@ -0,0 +1,258 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "MeshUtils.h"
+#include "LoaderUtils.h"
+#include "Renderable.h"
+
+using namespace std;
+
+// Fixed size pool of worker threads running queued jobs in FIFO order
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned threadCount = 0)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(2u, std::thread::hardware_concurrency());
+
+		for (unsigned i = 0; i < threadCount; i++)
+			workers.emplace_back([this] { WorkerLoop(); });
+	}
+
+	// Runs the jobs still queued, then joins the workers
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	std::future<void> Submit(std::function<void()> job)
+	{
+		std::packaged_task<void()> task(std::move(job));
+		std::future<void> done = task.get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(task));
+		}
+		wake.notify_one();
+		return done;
+	}
+
+	size_t ThreadCount() const { return workers.size(); }
+
+private:
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			std::packaged_task<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				task = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::packaged_task<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
+
+// Milliseconds spent in each stage of loading one asset. Everything but
+// gpuMs runs on a worker, gpuMs is filled in by the main thread.
+struct AssetTiming
+{
+	double queuedMs = 0.0;	// submit to worker pickup
+	double ioMs = 0.0;		// file reads (FBX import for meshes)
+	double parseMs = 0.0;	// FBX scene to SimpleMesh
+	double processMs = 0.0;	// mesh optimization passes
+	double gpuMs = 0.0;		// resource creation
+	size_t bytes = 0;
+};
+
+// A raw file (texture, shader blob) read on a worker
+struct FileAsset
+{
+	std::string filename;
+	std::vector<uint8_t> data;
+	AssetTiming timing;
+};
+
+// An FBX mesh plus the bytes of the texture it references
+struct MeshAsset
+{
+	std::string filename;
+	SimpleMesh<SimpleVertex> mesh;
+	std::string textureFilename;
+	std::vector<uint8_t> textureData;
+	AssetTiming timing;
+	// false when the FBX could not be imported, the mesh is then empty
+	bool loaded = false;
+};
+
+// Runs file I/O, FBX parsing and mesh processing on a thread pool. The
+// returned assets are complete once Wait returns, GPU resources are then
+// created from them on the main thread. Each FBX job uses its own
+// FbxManager since the SDK objects are not shared between threads.
+class AssetLoader
+{
+public:
+	explicit AssetLoader(unsigned threadCount = 0)
+		: start(Clock::now()), pool(threadCount)
+	{
+	}
+
+	// textureDirectory is prepended to the texture name found in the FBX
+	MeshAsset* LoadMesh(const std::string& filename, const std::string& textureDirectory)
+	{
+		meshes.emplace_back();
+		MeshAsset* asset = &meshes.back();
+		asset->filename = filename;
+
+		Clock::time_point queued = Clock::now();
+		pending.push_back(pool.Submit([asset, textureDirectory, queued]
+		{
+			Clock::time_point t0 = Clock::now();
+			asset->timing.queuedMs = Milliseconds(queued, t0);
+
+			FbxManager* manager = CreateFBXManager();
+			FbxScene* lScene = LoadFBXScene(manager, asset->filename.c_str());
+			Clock::time_point t1 = Clock::now();
+			if (!lScene)
+			{
+				manager->Destroy();
+				asset->timing.ioMs = Milliseconds(t0, t1);
+				return;
+			}
+
+			ProcessFBXMesh(lScene->GetRootNode(), asset->mesh, asset->textureFilename);
+			manager->Destroy();
+			Clock::time_point t2 = Clock::now();
+
+			MeshUtils::Compactify(asset->mesh);
+			Clock::time_point t3 = Clock::now();
+
+			if (asset->textureFilename != "")
+				asset->textureData = load_binary_blob((textureDirectory + asset->textureFilename).c_str());
+			Clock::time_point t4 = Clock::now();
+
+			asset->timing.ioMs = Milliseconds(t0, t1) + Milliseconds(t3, t4);
+			asset->timing.parseMs = Milliseconds(t1, t2);
+			asset->timing.processMs = Milliseconds(t2, t3);
+			asset->timing.bytes = asset->mesh.vertexList.size() * sizeof(SimpleVertex) +
+				asset->mesh.indicesList.size() * sizeof(int) + asset->textureData.size();
+			asset->loaded = true;
+		}));
+		return asset;
+	}
+
+	FileAsset* LoadFile(const std::string& filename)
+	{
+		files.emplace_back();
+		FileAsset* asset = &files.back();
+		asset->filename = filename;
+
+		Clock::time_point queued = Clock::now();
+		pending.push_back(pool.Submit([asset, queued]
+		{
+			Clock::time_point t0 = Clock::now();
+			asset->timing.queuedMs = Milliseconds(queued, t0);
+
+			asset->data = load_binary_blob(asset->filename.c_str());
+
+			asset->timing.ioMs = Milliseconds(t0, Clock::now());
+			asset->timing.bytes = asset->data.size();
+		}));
+		return asset;
+	}
+
+	// Blocks until every queued asset has been loaded, false when a mesh
+	// failed to import
+	bool Wait()
+	{
+		for (std::future<void>& done : pending)
+			done.get();
+		pending.clear();
+		workerDone = Clock::now();
+
+		bool loaded = true;
+		for (const MeshAsset& asset : meshes)
+		{
+			if (!asset.loaded)
+			{
+				cout << asset.filename << ": could not be loaded" << endl;
+				loaded = false;
+			}
+		}
+		return loaded;
+	}
+
+	void PrintTimings() const
+	{
+		cout << "\n" << left << setw(36) << "Asset" << right
+			<< setw(10) << "queued" << setw(10) << "io" << setw(10) << "parse"
+			<< setw(10) << "process" << setw(10) << "gpu" << setw(12) << "KB" << endl;
+
+		double total = 0.0;
+		auto row = [&](const std::string& name, const AssetTiming& t)
+		{
+			cout << left << setw(36) << getFileName(name) << right << fixed << setprecision(2)
+				<< setw(10) << t.queuedMs << setw(10) << t.ioMs << setw(10) << t.parseMs
+				<< setw(10) << t.processMs << setw(10) << t.gpuMs << setw(12) << t.bytes / 1024 << endl;
+			total += t.ioMs + t.parseMs + t.processMs + t.gpuMs;
+		};
+		for (const MeshAsset& asset : meshes)
+			row(asset.filename, asset.timing);
+		for (const FileAsset& asset : files)
+			row(asset.filename, asset.timing);
+
+		cout << "Worker threads: " << pool.ThreadCount()
+			<< ", loading: " << Milliseconds(start, workerDone) << " ms"
+			<< ", total: " << Milliseconds(start, Clock::now()) << " ms"
+			<< ", serial sum: " << total << " ms" << endl;
+		cout.unsetf(std::ios_base::floatfield);
+	}
+
+private:
+	using Clock = std::chrono::high_resolution_clock;
+
+	static double Milliseconds(Clock::time_point from, Clock::time_point to)
+	{
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+
+	// deques so the returned pointers stay valid while more assets are queued
+	std::deque<MeshAsset> meshes;
+	std::deque<FileAsset> files;
+	std::vector<std::future<void>> pending;
+	Clock::time_point start;
+	Clock::time_point workerDone;
+	// last, so its workers are joined before the assets they write are destroyed
+	ThreadPool pool;
+};
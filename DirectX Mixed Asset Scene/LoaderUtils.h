@@ -9,7 +9,6 @@
 #include "MeshUtils.h"
 #include <string>
 
-FbxManager* gSdkManager;
 float scale = 1.0f / 40.0f;
 
 // funtime random normal
@@ -18,45 +17,46 @@ float scale = 1.0f / 40.0f;
 // Add FBX mesh process function declaration here
 void ProcessFBXMesh(FbxNode* Node, SimpleMesh<SimpleVertex>& simpleMesh, std::string& textureFilename);
 
-void InitFBX()
+// Each thread importing FBX files needs its own manager
+FbxManager* CreateFBXManager()
 {
-	gSdkManager = FbxManager::Create();
+	FbxManager* manager = FbxManager::Create();
 
 	// create an IOSettings object
-	FbxIOSettings* ios = FbxIOSettings::Create(gSdkManager, IOSROOT);
-	gSdkManager->SetIOSettings(ios);
+	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+	manager->SetIOSettings(ios);
+	return manager;
 }
 
-void LoadFBX(const std::string& filename, SimpleMesh<SimpleVertex> &simpleMesh, std::string& textureFilename)
+// Imports a file into a new scene of manager, nullptr when the file can
+// not be opened or imported
+FbxScene* LoadFBXScene(FbxManager* manager, const char* ImportFileName)
 {
-	const char* ImportFileName = filename.c_str(); 
-
-	// Create a scene
-	FbxScene* lScene = FbxScene::Create(gSdkManager, "");
-
-	FbxImporter* lImporter = FbxImporter::Create(gSdkManager, "");
+	FbxImporter* lImporter = FbxImporter::Create(manager, "");
 
 	// Initialize the importer by providing a filename.
-	if (!lImporter->Initialize(ImportFileName, -1, gSdkManager->GetIOSettings())) {
-		printf("Call to FbxImporter::Initialize() failed.\n");
+	if (!lImporter->Initialize(ImportFileName, -1, manager->GetIOSettings())) {
+		printf("Call to FbxImporter::Initialize() failed for %s.\n", ImportFileName);
 		printf("Error returned: %s\n\n", lImporter->GetStatus().GetErrorString());
-		//exit(-1);
+		lImporter->Destroy();
+		return nullptr;
 	}
 
+	// Create a scene
+	FbxScene* lScene = FbxScene::Create(manager, "");
+
 	// Import the scene.
-	bool lStatus = lImporter->Import(lScene);
+	if (!lImporter->Import(lScene)) {
+		printf("Call to FbxImporter::Import() failed for %s.\n", ImportFileName);
+		printf("Error returned: %s\n\n", lImporter->GetStatus().GetErrorString());
+		lScene->Destroy();
+		lScene = nullptr;
+	}
 
 	// Destroy the importer
 	lImporter->Destroy();
 
-	// Process the scene and build DirectX Arrays
-	ProcessFBXMesh(lScene->GetRootNode(), simpleMesh, textureFilename);
-
-	// Optimize the mesh
-	MeshUtils::Compactify(simpleMesh);
-
-	// Destroy the (no longer needed) scene
-	lScene->Destroy();
+	return lScene;
 }
 
 string getFileName(const string& s)
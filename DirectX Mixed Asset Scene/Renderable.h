@@ -147,9 +147,14 @@ public:
 		ID3D11Device* device, const char* filename,
 		D3D11_INPUT_ELEMENT_DESC layout[], UINT numElements)
 	{
-		HRESULT hr = S_OK;
+		return CreateVertexShaderAndInputLayoutFromBlob(device, load_binary_blob(filename), layout, numElements);
+	}
 
-		auto vs_blob = load_binary_blob(filename);
+	HRESULT CreateVertexShaderAndInputLayoutFromBlob(
+		ID3D11Device* device, const std::vector<uint8_t>& vs_blob,
+		D3D11_INPUT_ELEMENT_DESC layout[], UINT numElements)
+	{
+		HRESULT hr = S_OK;
 
 		// Create the vertex shader
 		hr = device->CreateVertexShader(vs_blob.data(), vs_blob.size(), nullptr,
@@ -168,12 +173,15 @@ public:
 
 	HRESULT CreatePixelShaderFromFile(ID3D11Device* device, const char* filename)
 	{
-		HRESULT hr = S_OK;
+		return CreatePixelShaderFromBlob(device, load_binary_blob(filename));
+	}
 
-		auto vs_blob = load_binary_blob(filename);
+	HRESULT CreatePixelShaderFromBlob(ID3D11Device* device, const std::vector<uint8_t>& ps_blob)
+	{
+		HRESULT hr = S_OK;
 
 		// Create the pixel shader
-		hr = device->CreatePixelShader(vs_blob.data(), vs_blob.size(), nullptr,
+		hr = device->CreatePixelShader(ps_blob.data(), ps_blob.size(), nullptr,
 			pixelShader.ReleaseAndGetAddressOf());
 		return hr;
 	}
@@ -212,6 +220,16 @@ public:
 		return hr;
 	}
 
+	// DDS file contents already read into memory (by the AssetLoader)
+	HRESULT CreateTextureFromMemory(ID3D11Device* device, const std::vector<uint8_t>& dds)
+	{
+		if (dds.empty())
+			return E_FAIL;
+
+		return CreateDDSTextureFromMemory(device, dds.data(), dds.size(), nullptr,
+			resourceView.ReleaseAndGetAddressOf());
+	}
+
 	HRESULT CreateDefaultSampler(ID3D11Device* device)
 	{
 		HRESULT hr = S_OK;
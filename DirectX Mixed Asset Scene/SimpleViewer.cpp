@@ -24,6 +24,7 @@
 #include "LineUtils.h"
 #include "Renderable.h"
 #include "LoaderUtils.h"
+#include "AssetLoader.h"
 
 using namespace DirectX;
 using namespace std;
@@ -608,29 +609,34 @@ HRESULT InitContent()
 	InitDepthStates();
 	InitSkybox();
 	InitBlendState();
-	InitFBX();
 
 	//modelViewProjection = new ConstantBufferTransforms();
 
 	HRESULT hr = S_OK;
 
+	// Read and process every asset on the worker threads, only the
+	// resource creation below runs on this thread
+	AssetLoader loader;
+	MeshAsset* chestAsset = loader.LoadMesh(".//Assets//Chest1-1.fbx", ".//Assets//");
+	MeshAsset* boxAsset = loader.LoadMesh(".//Assets//cube.fbx", ".//Assets//");
+	MeshAsset* duckAsset = loader.LoadMesh(".//Assets//duck_tris.fbx", ".//Assets//");
+	FileAsset* grassTexture = loader.LoadFile("grass.dds");
+	FileAsset* meshVS = loader.LoadFile("Tutorial06_VS.cso");
+	FileAsset* meshPS = loader.LoadFile("Tutorial06_PS.cso");
+	if (!loader.Wait())
+		return E_FAIL;
+
 	//////////////////////////////////////////
 	//Create mesh render components
 	//////////////////////////////////////////
 	// 
 	//Chest
 	{
+		auto gpuStart = std::chrono::high_resolution_clock::now();
 		Renderable meshRenderable;
 
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		//LoadFBX(".//Assets//cube.fbx", mesh, filename);
-		LoadFBX(".//Assets//Chest1-1.fbx", mesh, filename);
+		// Geometry and texture were loaded by the AssetLoader
+		SimpleMesh<SimpleVertex>& mesh = chestAsset->mesh;
 
 		// Create the vertex buffers from the generated SimpleMesh
 		hr = meshRenderable.CreateBuffers(
@@ -641,9 +647,9 @@ HRESULT InitContent()
 			mesh.vertexList.size());
 
 		// Load the Texture when texture filename is valid
-		if (filename != "")
-		{ 
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, ".//Assets//" +filename);
+		if (chestAsset->textureFilename != "")
+		{
+			hr = meshRenderable.CreateTextureFromMemory(g_pd3dDevice, chestAsset->textureData);
 			if (FAILED(hr))
 				return hr;
 
@@ -660,8 +666,8 @@ HRESULT InitContent()
 		};
 
 		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromBlob(g_pd3dDevice, meshVS->data, layout, ARRAYSIZE(layout));
+		hr = meshRenderable.CreatePixelShaderFromBlob(g_pd3dDevice, meshPS->data);
 
 		// Create the shader constant buffer
 		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
@@ -672,21 +678,16 @@ HRESULT InitContent()
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f));
 		renderables.push_back(meshRenderable);
 
+		chestAsset->timing.gpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - gpuStart).count();
 	}
 
 	//Box
 	{
+		auto gpuStart = std::chrono::high_resolution_clock::now();
 		Renderable meshRenderable;
 
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		LoadFBX(".//Assets//cube.fbx", mesh, filename);
-		//LoadFBX(".//Assets//Chest1-1.fbx", mesh, filename);
+		// Geometry and texture were loaded by the AssetLoader
+		SimpleMesh<SimpleVertex>& mesh = boxAsset->mesh;
 
 		// Create the vertex buffers from the generated SimpleMesh
 		hr = meshRenderable.CreateBuffers(
@@ -697,9 +698,9 @@ HRESULT InitContent()
 			mesh.vertexList.size());
 
 		// Load the Texture when texture filename is valid
-		if (filename != "")
+		if (boxAsset->textureFilename != "")
 		{
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, ".//Assets//" + filename);
+			hr = meshRenderable.CreateTextureFromMemory(g_pd3dDevice, boxAsset->textureData);
 			if (FAILED(hr))
 				return hr;
 
@@ -716,8 +717,8 @@ HRESULT InitContent()
 		};
 
 		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromBlob(g_pd3dDevice, meshVS->data, layout, ARRAYSIZE(layout));
+		hr = meshRenderable.CreatePixelShaderFromBlob(g_pd3dDevice, meshPS->data);
 
 		// Create the shader constant buffer
 		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
@@ -728,21 +729,16 @@ HRESULT InitContent()
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f));
 		renderables.push_back(meshRenderable);
 
+		boxAsset->timing.gpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - gpuStart).count();
 	}
 
 	//Duck
 	{
+		auto gpuStart = std::chrono::high_resolution_clock::now();
 		Renderable meshRenderable;
 
-		// Generate the geometry
-		SimpleMesh<SimpleVertex> mesh;
-
-		// filename for texture file
-		std::string filename;
-
-		// Load it!
-		LoadFBX(".//Assets//duck_tris.fbx", mesh, filename);
-		//LoadFBX(".//Assets//Chest1-1.fbx", mesh, filename);
+		// Geometry and texture were loaded by the AssetLoader
+		SimpleMesh<SimpleVertex>& mesh = duckAsset->mesh;
 
 		// Create the vertex buffers from the generated SimpleMesh
 		hr = meshRenderable.CreateBuffers(
@@ -753,9 +749,9 @@ HRESULT InitContent()
 			mesh.vertexList.size());
 
 		// Load the Texture when texture filename is valid
-		if (filename != "")
+		if (duckAsset->textureFilename != "")
 		{
-			hr = meshRenderable.CreateTextureFromFile(g_pd3dDevice, ".//Assets//" + filename);
+			hr = meshRenderable.CreateTextureFromMemory(g_pd3dDevice, duckAsset->textureData);
 			if (FAILED(hr))
 				return hr;
 
@@ -772,8 +768,8 @@ HRESULT InitContent()
 		};
 
 		// Create the shaders
-		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderable.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+		hr = meshRenderable.CreateVertexShaderAndInputLayoutFromBlob(g_pd3dDevice, meshVS->data, layout, ARRAYSIZE(layout));
+		hr = meshRenderable.CreatePixelShaderFromBlob(g_pd3dDevice, meshPS->data);
 
 		// Create the shader constant buffer
 		hr = meshRenderable.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
@@ -784,10 +780,12 @@ HRESULT InitContent()
 		meshRenderable.setRotation(XMMatrixRotationY(3.14159265359f));
 		renderables.push_back(meshRenderable);
 
+		duckAsset->timing.gpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - gpuStart).count();
 	}
 
 	//Grass
 	{
+		auto gpuStart = std::chrono::high_resolution_clock::now();
 		Renderable meshRenderableGrass;
 		// Generate the geometry
 		SimpleMesh<SimpleVertex> grassMesh;
@@ -809,7 +807,7 @@ HRESULT InitContent()
 			grassMesh.vertexList.size());
 
 		// Load the Texture
-		hr = meshRenderableGrass.CreateTextureFromFile(g_pd3dDevice, filename);
+		hr = meshRenderableGrass.CreateTextureFromMemory(g_pd3dDevice, grassTexture->data);
 		if (FAILED(hr))
 			return hr;
 
@@ -825,8 +823,8 @@ HRESULT InitContent()
 		};
 
 		// Create the shaders
-		hr = meshRenderableGrass.CreateVertexShaderAndInputLayoutFromFile(g_pd3dDevice, "Tutorial06_VS.cso", layout, ARRAYSIZE(layout));
-		hr = meshRenderableGrass.CreatePixelShaderFromFile(g_pd3dDevice, "Tutorial06_PS.cso");
+		hr = meshRenderableGrass.CreateVertexShaderAndInputLayoutFromBlob(g_pd3dDevice, meshVS->data, layout, ARRAYSIZE(layout));
+		hr = meshRenderableGrass.CreatePixelShaderFromBlob(g_pd3dDevice, meshPS->data);
 
 		hr = meshRenderableGrass.CreateConstantBufferVS(g_pd3dDevice, sizeof(TransformsConstantBuffer));
 		hr = meshRenderableGrass.CreateConstantBufferPS(g_pd3dDevice, sizeof(LightsConstantBuffer));
@@ -836,6 +834,8 @@ HRESULT InitContent()
 		grassRenderables.push_back(meshRenderableGrass);
 		meshRenderableGrass.setPosition(3.0f, 1.0f, -2.0f);
 		grassRenderables.push_back(meshRenderableGrass);
+
+		grassTexture->timing.gpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - gpuStart).count();
 	}
 
 	// Create grid render components
@@ -872,6 +872,9 @@ HRESULT InitContent()
 
 	g_pImmediateContext->RSSetState(rasterStateDefault);
 
+	// per asset breakdown of the load
+	loader.PrintTimings();
+
 	return S_OK;
 }
 